@@ -119,7 +119,9 @@ Level = {
                 boxcollider = {
                     width = 32,
                     height = 25,
-                    offset = { x = 0, y = 5 }
+                    offset = { x = 0, y = 5 },
+                    layer = "player",
+                    mask = { "default", "projectile" }
                 },
                 health = {
                     health_percentage = 100
@@ -2,18 +2,30 @@
 #define BOXCOLLIDERCOMPONENT_H
 
 #include <glm/glm.hpp>
+#include "../Physics/CollisionLayers.h"
 
 struct BoxColliderComponent
 {
     int width;
     int height;
     glm::vec2 offset;
+    // Layer of the collider and layers it collides with (see Physics/CollisionLayers.h).
+    // An invalid layer is replaced by the default layer
+    int layer;
+    CollisionMask mask;
 
-    BoxColliderComponent(int width = 0, int height = 0, glm::vec2 offset = glm::vec2(0))
+    BoxColliderComponent(int width = 0, int height = 0, glm::vec2 offset = glm::vec2(0), int layer = COLLISION_LAYER_DEFAULT)
+        : BoxColliderComponent(width, height, offset, layer, CollisionLayers::GetDefaultMask(IsValidCollisionLayer(layer) ? layer : COLLISION_LAYER_DEFAULT))
+    {
+    }
+
+    BoxColliderComponent(int width, int height, glm::vec2 offset, int layer, CollisionMask mask)
     {
         this->width = width;
         this->height = height;
         this->offset = offset;
+        this->layer = IsValidCollisionLayer(layer) ? layer : COLLISION_LAYER_DEFAULT;
+        this->mask = mask;
     }
 };
 
@@ -0,0 +1,35 @@
+#ifndef COMPONENTS_H
+#define COMPONENTS_H
+
+#include "../ECS/ComponentList.h"
+
+// Every component type used by the game must be listed here
+struct TransformComponent;
+struct RigidBodyComponent;
+struct SpriteComponent;
+struct AnimationComponent;
+struct BoxColliderComponent;
+struct KeyboardControlledComponent;
+struct CameraFollowComponent;
+struct ProjectileEmitterComponent;
+struct ProjectileComponent;
+struct HealthComponent;
+struct TextLabelComponent;
+struct ScriptComponent;
+
+typedef ComponentList<
+    TransformComponent,
+    RigidBodyComponent,
+    SpriteComponent,
+    AnimationComponent,
+    BoxColliderComponent,
+    KeyboardControlledComponent,
+    CameraFollowComponent,
+    ProjectileEmitterComponent,
+    ProjectileComponent,
+    HealthComponent,
+    TextLabelComponent,
+    ScriptComponent>
+    GameComponents;
+
+#endif
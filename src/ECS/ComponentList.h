@@ -0,0 +1,34 @@
+#ifndef COMPONENTLIST_H
+#define COMPONENTLIST_H
+
+#include <type_traits>
+
+////////////////////////////////////////////////////////////////////////////////
+// ComponentList
+////////////////////////////////////////////////////////////////////////////////
+// Compile-time list of component types. The position of a type in the list
+// is its component id, so ids and the signature width are known at compile
+// time and every pool lives in a fixed slot of the registry
+////////////////////////////////////////////////////////////////////////////////
+template <typename... TComponents>
+struct ComponentList
+{
+    static constexpr unsigned int size = sizeof...(TComponents);
+
+    // Returns the index of T in the list, or -1 if T was not registered
+    template <typename T>
+    static constexpr int IndexOf()
+    {
+        constexpr bool matches[] = {std::is_same<T, TComponents>::value...};
+        for (unsigned int i = 0; i < size; i++)
+        {
+            if (matches[i])
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+#endif
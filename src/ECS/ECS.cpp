@@ -1,29 +1,103 @@
 #include <algorithm>
+#include <fstream>
+#include <cstdlib>
+#ifdef __GNUG__
+#include <cxxabi.h>
+#endif
 #include "ECS.h"
 #include "../Logger/Logger.h"
 
-int IComponent::nextId = 0;
+std::string GetTypeName(const char *mangledName)
+{
+#ifdef __GNUG__
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(mangledName, nullptr, nullptr, &status);
+    if (status == 0 && demangled)
+    {
+        std::string name(demangled);
+        std::free(demangled);
+        return name;
+    }
+#endif
+    return mangledName;
+}
+
+EntityGenerations::~EntityGenerations()
+{
+    for (auto &page : pages)
+    {
+        delete[] page.load();
+    }
+}
+
+void EntityGenerations::Activate(int index)
+{
+    auto &page = pages[index / PAGE_SIZE];
+    if (!page.load(std::memory_order_relaxed))
+    {
+        auto newPage = new std::atomic<std::uint32_t>[PAGE_SIZE];
+        for (int i = 0; i < PAGE_SIZE; i++)
+        {
+            newPage[i].store(0, std::memory_order_relaxed);
+        }
+        page.store(newPage, std::memory_order_release);
+    }
+    auto &slot = page.load(std::memory_order_relaxed)[index % PAGE_SIZE];
+    slot.store(slot.load(std::memory_order_relaxed) | ALIVE_FLAG, std::memory_order_release);
+}
+
+void EntityGenerations::Release(int index)
+{
+    auto &slot = pages[index / PAGE_SIZE].load(std::memory_order_relaxed)[index % PAGE_SIZE];
+    const auto generation = slot.load(std::memory_order_relaxed) & ENTITY_GENERATION_MASK;
+    slot.store((generation + 1) & ENTITY_GENERATION_MASK, std::memory_order_release);
+}
 
 void Entity::Kill()
 {
     registry->KillEntity(*this);
 }
 
+bool Entity::IsValid() const
+{
+    return registry && registry->Valid(*this);
+}
+
+void Entity::Tag(TagId tag)
+{
+    registry->TagEntity(*this, tag);
+}
+
 void Entity::Tag(const std::string &tag)
 {
     registry->TagEntity(*this, tag);
 }
 
+bool Entity::HasTag(TagId tag) const
+{
+    return registry->EntityHasTag(*this, tag);
+}
+
 bool Entity::HasTag(const std::string &tag) const
 {
     return registry->EntityHasTag(*this, tag);
 }
 
+void Entity::Group(GroupId group)
+{
+    registry->GroupEntity(*this, group);
+}
+
 void Entity::Group(const std::string &group)
 {
     registry->GroupEntity(*this, group);
 }
 
+bool Entity::BelongsToGroup(GroupId group) const
+{
+    return registry->EntityBelongsToGroup(*this, group);
+}
+
 bool Entity::BelongsToGroup(const std::string &group) const
 {
     return registry->EntityBelongsToGroup(*this, group);
@@ -31,20 +105,44 @@ bool Entity::BelongsToGroup(const std::string &group) const
 
 void System::AddEntity(Entity entity)
 {
+    const auto entityId = entity.GetId();
+    if (entityId >= static_cast<int>(entityIndices.size()))
+    {
+        entityIndices.resize(entityId + 1, -1);
+    }
+    if (entityIndices[entityId] != -1)
+    {
+        return;
+    }
+    entityIndices[entityId] = entities.size();
     entities.push_back(entity);
 }
 
 void System::RemoveEntity(Entity entity)
 {
-    entities.erase(
-        std::remove_if(
-            entities.begin(), entities.end(),
-            [&entity](Entity otherEntity)
-            { return entity == otherEntity; }),
-        entities.end());
+    if (!HasEntity(entity))
+    {
+        return;
+    }
+
+    // Move the last entity to the removed position to keep the list packed
+    const auto entityId = entity.GetId();
+    const int indexOfRemoved = entityIndices[entityId];
+    const Entity lastEntity = entities.back();
+    entities[indexOfRemoved] = lastEntity;
+    entityIndices[lastEntity.GetId()] = indexOfRemoved;
+
+    entities.pop_back();
+    entityIndices[entityId] = -1;
+}
+
+bool System::HasEntity(Entity entity) const
+{
+    const auto entityId = entity.GetId();
+    return entityId < static_cast<int>(entityIndices.size()) && entityIndices[entityId] != -1;
 }
 
-std::vector<Entity> System::GetSystemEntities() const
+const std::vector<Entity> &System::GetSystemEntities() const
 {
     return entities;
 }
@@ -54,15 +152,297 @@ const Signature System::GetComponentsSignature() const
     return componentSignature;
 }
 
-Entity Registry::CreateEntity()
+bool System::ConflictsWith(const System &other) const
+{
+    if (isExclusive || other.isExclusive)
+    {
+        return true;
+    }
+    return (componentWrites & other.componentReads).any() ||
+           (other.componentWrites & componentReads).any() ||
+           (resourceWrites & other.resourceReads).any() ||
+           (other.resourceWrites & resourceReads).any();
+}
+
+void System::ReadsResource(SystemResource resource)
+{
+    resourceReads.set(resource);
+}
+
+void System::WritesResource(SystemResource resource)
+{
+    resourceReads.set(resource);
+    resourceWrites.set(resource);
+}
+
+void System::RequireExclusiveAccess()
+{
+    isExclusive = true;
+}
+
+Archetype::Archetype(const Signature &signature, const std::array<ComponentInfo, MAX_COMPONENTS> &componentInfos)
+    : signature(signature), componentInfos(componentInfos), size(0)
+{
+    columnOffsets.fill(-1);
+    addEdges.fill(nullptr);
+    removeEdges.fill(nullptr);
+
+    // Compute how many rows fit in a chunk: the entity id column comes first, followed by one column per component
+    int rowBytes = sizeof(int);
+    for (unsigned int componentId = 0; componentId < MAX_COMPONENTS; componentId++)
+    {
+        if (signature.test(componentId))
+        {
+            componentIds.push_back(componentId);
+            rowBytes += componentInfos[componentId].size;
+        }
+    }
+    chunkCapacity = std::max(ARCHETYPE_CHUNK_SIZE / rowBytes, 1);
+
+    // Lay out the columns, shrinking the capacity until the alignment padding also fits in the chunk
+    while (true)
+    {
+        int offset = chunkCapacity * sizeof(int);
+        for (auto componentId : componentIds)
+        {
+            const auto &info = componentInfos[componentId];
+            offset = (offset + info.alignment - 1) / info.alignment * info.alignment;
+            columnOffsets[componentId] = offset;
+            offset += chunkCapacity * info.size;
+        }
+        if (offset <= ARCHETYPE_CHUNK_SIZE || chunkCapacity == 1)
+        {
+            chunkBytes = std::max(offset, ARCHETYPE_CHUNK_SIZE);
+            break;
+        }
+        chunkCapacity--;
+    }
+}
+
+Archetype::~Archetype()
+{
+    for (int row = 0; row < size; row++)
+    {
+        for (auto componentId : componentIds)
+        {
+            componentInfos[componentId].destroy(GetComponent(row, componentId));
+        }
+    }
+}
+
+int Archetype::AddRow(int entityId)
+{
+    if (size == static_cast<int>(chunks.size()) * chunkCapacity)
+    {
+        Chunk chunk;
+        chunk.memory.reset(new unsigned char[chunkBytes]);
+        chunk.versions.reset(new std::atomic<std::uint32_t>[MAX_COMPONENTS]);
+        for (unsigned int componentId = 0; componentId < MAX_COMPONENTS; componentId++)
+        {
+            chunk.versions[componentId].store(0, std::memory_order_relaxed);
+        }
+        chunks.push_back(std::move(chunk));
+        numChunkAllocations++;
+    }
+    auto &chunk = chunks.back();
+    GetEntityIds(chunks.size() - 1)[chunk.count] = entityId;
+    chunk.count++;
+    return size++;
+}
+
+int Archetype::RemoveRow(int row)
+{
+    const int lastRow = size - 1;
+    int movedEntityId = -1;
+    if (row != lastRow)
+    {
+        // Relocate the last row into the hole to keep the chunks packed
+        for (auto componentId : componentIds)
+        {
+            componentInfos[componentId].relocate(GetComponent(row, componentId), GetComponent(lastRow, componentId));
+        }
+        movedEntityId = GetEntityIds(lastRow / chunkCapacity)[lastRow % chunkCapacity];
+        GetEntityIds(row / chunkCapacity)[row % chunkCapacity] = movedEntityId;
+        MergeVersions(row, *this, lastRow);
+    }
+
+    chunks.back().count--;
+    if (chunks.back().count == 0)
+    {
+        chunks.pop_back();
+    }
+    size--;
+    return movedEntityId;
+}
+
+void Archetype::MarkChanged(int row, int componentId, std::uint32_t version) const
+{
+    auto &chunkVersion = chunks[row / chunkCapacity].versions[componentId];
+    auto current = chunkVersion.load(std::memory_order_relaxed);
+    while (current < version && !chunkVersion.compare_exchange_weak(current, version, std::memory_order_relaxed))
+    {
+    }
+}
+
+void Archetype::MergeVersions(int row, const Archetype &source, int sourceRow) const
+{
+    const int sourceChunk = sourceRow / source.chunkCapacity;
+    for (auto componentId : source.componentIds)
+    {
+        if (signature.test(componentId))
+        {
+            MarkChanged(row, componentId, source.GetChunkVersion(sourceChunk, componentId));
+        }
+    }
+}
+
+Archetype *ArchetypeStorage::GetArchetype(const Signature &signature)
+{
+    auto &archetype = archetypesPerSignature[signature];
+    if (!archetype)
+    {
+        archetype = std::make_unique<Archetype>(signature, componentInfos);
+        archetypes.push_back(archetype.get());
+    }
+    return archetype.get();
+}
+
+void ArchetypeStorage::MoveEntity(int entityId, Archetype *destination)
+{
+    auto &location = entityLocations[entityId];
+    Archetype *source = location.archetype;
+
+    int newRow = destination ? destination->AddRow(entityId) : -1;
+    if (source)
+    {
+        if (destination)
+        {
+            destination->MergeVersions(newRow, *source, location.row);
+        }
+
+        // Relocate the components that the entity keeps and destroy the ones it loses
+        for (auto componentId : source->GetComponentIds())
+        {
+            void *component = source->GetComponent(location.row, componentId);
+            if (destination && destination->GetSignature().test(componentId))
+            {
+                componentInfos[componentId].relocate(destination->GetComponent(newRow, componentId), component);
+            }
+            else
+            {
+                componentInfos[componentId].destroy(component);
+            }
+        }
+
+        int movedEntityId = source->RemoveRow(location.row);
+        if (movedEntityId != -1)
+        {
+            entityLocations[movedEntityId].row = location.row;
+        }
+    }
+
+    // Keep the per-component counts used by the stats
+    const Signature sourceSignature = source ? source->GetSignature() : Signature();
+    const Signature destinationSignature = destination ? destination->GetSignature() : Signature();
+    for (unsigned int componentId = 0; componentId < MAX_COMPONENTS; componentId++)
+    {
+        if (sourceSignature.test(componentId) != destinationSignature.test(componentId))
+        {
+            componentCounts[componentId] += destinationSignature.test(componentId) ? 1 : -1;
+            peakComponentCounts[componentId] = std::max(peakComponentCounts[componentId], componentCounts[componentId]);
+        }
+    }
+
+    location.archetype = destination;
+    location.row = newRow;
+}
+
+void ArchetypeStorage::AddCopies(const int *entityIds, int count, const Signature &signature, const std::array<const void *, MAX_COMPONENTS> &prototypes, std::uint32_t version)
+{
+    Archetype *destination = GetArchetype(signature);
+    for (int i = 0; i < count; i++)
+    {
+        const int entityId = entityIds[i];
+        if (entityId >= static_cast<int>(entityLocations.size()))
+        {
+            entityLocations.resize(entityId + 1);
+        }
+        MoveEntity(entityId, destination);
+
+        const int row = entityLocations[entityId].row;
+        for (auto componentId : destination->GetComponentIds())
+        {
+            componentInfos[componentId].copy(destination->GetComponent(row, componentId), prototypes[componentId]);
+            destination->MarkChanged(row, componentId, version);
+        }
+    }
+}
+
+void ArchetypeStorage::Remove(int entityId, int componentId)
+{
+    Archetype *source = entityLocations[entityId].archetype;
+    if (!source || !source->GetSignature().test(componentId))
+    {
+        return;
+    }
+
+    Archetype *destination = source->removeEdges[componentId];
+    if (!destination)
+    {
+        Signature signature = source->GetSignature();
+        signature.reset(componentId);
+        destination = signature.any() ? GetArchetype(signature) : nullptr;
+        source->removeEdges[componentId] = destination;
+    }
+    MoveEntity(entityId, destination);
+}
+
+ComponentStats ArchetypeStorage::GetStats(int componentId) const
+{
+    const auto &info = componentInfos[componentId];
+    ComponentStats stats;
+    stats.name = GetTypeName(info.type->name());
+    stats.elementSize = info.size;
+    stats.count = componentCounts[componentId];
+    stats.peakCount = peakComponentCounts[componentId];
+    for (auto archetype : archetypes)
+    {
+        if (!archetype->GetSignature().test(componentId))
+        {
+            continue;
+        }
+        const int capacity = archetype->GetNumChunks() * archetype->GetChunkCapacity();
+        stats.capacity += capacity;
+        stats.bytes += capacity * info.size;
+        stats.growEvents += archetype->GetNumChunkAllocations();
+    }
+    return stats;
+}
+
+void ArchetypeStorage::RemoveEntity(int entityId)
+{
+    if (entityId < static_cast<int>(entityLocations.size()) && entityLocations[entityId].archetype)
+    {
+        MoveEntity(entityId, nullptr);
+    }
+}
+
+int Registry::NextEntityId()
 {
     int entityId;
     if (freeIds.empty())
     {
+        if (numEntities >= MAX_ENTITIES)
+        {
+            Logger::Err("Reached the maximum number of entities (" + std::to_string(MAX_ENTITIES) + ")");
+            return -1;
+        }
         entityId = numEntities++;
         if (entityId >= static_cast<int>(entityComponentSignatures.size()))
         {
             entityComponentSignatures.resize(entityId + 1);
+            tagPerEntity.resize(entityId + 1, -1);
+            entityGroups.resize(entityId + 1);
         }
     }
     else
@@ -70,119 +450,534 @@ Entity Registry::CreateEntity()
         entityId = freeIds.front();
         freeIds.pop_front();
     }
-    Entity entity(entityId);
+    entityGenerations.Activate(entityId);
+    return entityId;
+}
+
+Entity Registry::CreateEntity()
+{
+    int entityId = NextEntityId();
+    if (entityId == -1)
+    {
+        Entity invalid(-1);
+        invalid.registry = this;
+        return invalid;
+    }
+    Entity entity(entityId, entityGenerations.GetGeneration(entityId));
     entity.registry = this;
-    entitiesToBeAdded.insert(entity);
+    entitiesToBeAdded.push_back(entity);
 
     Logger::Log("Entity created with id: " + std::to_string(entityId));
     return entity;
 }
 
+std::vector<Entity> Registry::CreateEntities(int count)
+{
+    std::vector<Entity> entities;
+    entities.reserve(count);
+    entitiesToBeAdded.reserve(entitiesToBeAdded.size() + count);
+    for (int i = 0; i < count; i++)
+    {
+        const int entityId = NextEntityId();
+        if (entityId == -1)
+        {
+            break;
+        }
+        Entity entity(entityId, entityGenerations.GetGeneration(entityId));
+        entity.registry = this;
+        entities.push_back(entity);
+        entitiesToBeAdded.push_back(entity);
+    }
+
+    Logger::Log(std::to_string(entities.size()) + " entities created");
+    return entities;
+}
+
 void Registry::KillEntity(Entity entity)
 {
-    entitiesToBeKilled.insert(entity);
+    if (!Valid(entity))
+    {
+        Logger::Err("Tried to kill an entity that is no longer valid: " + std::to_string(entity.GetId()));
+        return;
+    }
+    entitiesToBeKilled.push_back(entity);
     Logger::Log("Entity " + std::to_string(entity.GetId()) + " was killed");
 }
 
-void Registry::TagEntity(Entity entity, const std::string &tag)
+// Interned names, reachable from systems running on the job threads
+struct NameIds
+{
+    std::mutex mutex;
+    std::unordered_map<std::string, int> ids;
+};
+
+// Function statics, so the names can be interned while other translation units are initialized
+static NameIds &TagIds()
 {
-    entityPerTag.emplace(tag, entity);
-    tagPerEntity.emplace(entity.GetId(), tag);
+    static NameIds tagIds;
+    return tagIds;
 }
 
-bool Registry::EntityHasTag(Entity entity, const std::string &tag) const
+static NameIds &GroupIds()
 {
-    if (tagPerEntity.find(entity.GetId()) == tagPerEntity.end())
+    static NameIds groupIds;
+    return groupIds;
+}
+
+// Returns the id of a name, assigning the next free id the first time the name is seen (isNew tells which)
+static int InternName(NameIds &names, const std::string &name, bool &isNew)
+{
+    std::lock_guard<std::mutex> lock(names.mutex);
+    auto id = names.ids.find(name);
+    isNew = id == names.ids.end();
+    if (!isNew)
     {
-        return false;
+        return id->second;
+    }
+    const int newId = names.ids.size();
+    names.ids.emplace(name, newId);
+    return newId;
+}
+
+static int FindName(NameIds &names, const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(names.mutex);
+    auto id = names.ids.find(name);
+    return id != names.ids.end() ? id->second : -1;
+}
+
+TagId Registry::GetTagId(const std::string &tag)
+{
+    bool isNew;
+    return InternName(TagIds(), tag, isNew);
+}
+
+TagId Registry::FindTagId(const std::string &tag)
+{
+    return FindName(TagIds(), tag);
+}
+
+GroupId Registry::FindGroupId(const std::string &group)
+{
+    return FindName(GroupIds(), group);
+}
+
+GroupId Registry::GetGroupId(const std::string &group)
+{
+    bool isNew;
+    const GroupId groupId = InternName(GroupIds(), group, isNew);
+    if (isNew && groupId >= static_cast<int>(MAX_GROUPS))
+    {
+        Logger::Err("Too many entity groups, group " + group + " will be ignored");
+    }
+    return groupId;
+}
+
+void Registry::TagEntity(Entity entity, TagId tag)
+{
+    if (!HasEntitySlot(entity) || tag < 0)
+    {
+        return;
+    }
+    RemoveEntityTag(entity);
+    if (tag >= static_cast<int>(entityPerTag.size()))
+    {
+        entityPerTag.resize(tag + 1, Entity(-1));
+    }
+    // A tag belongs to a single entity, so the previous holder loses it
+    const Entity previous = entityPerTag[tag];
+    if (HasEntitySlot(previous) && tagPerEntity[previous.GetId()] == tag)
+    {
+        tagPerEntity[previous.GetId()] = -1;
     }
-    return entityPerTag.find(tag)->second == entity;
+    entityPerTag[tag] = entity;
+    tagPerEntity[entity.GetId()] = tag;
+}
+
+void Registry::TagEntity(Entity entity, const std::string &tag)
+{
+    TagEntity(entity, GetTagId(tag));
+}
+
+bool Registry::EntityHasTag(Entity entity, TagId tag) const
+{
+    return tag != -1 && HasEntitySlot(entity) && tagPerEntity[entity.GetId()] == tag;
+}
+
+bool Registry::EntityHasTag(Entity entity, const std::string &tag) const
+{
+    return EntityHasTag(entity, FindTagId(tag));
+}
+
+Entity Registry::GetEntityByTag(TagId tag) const
+{
+    // The entity keeps the registry even when no entity has the tag, so IsValid() can be asked
+    Entity entity = tag >= 0 && tag < static_cast<int>(entityPerTag.size()) ? entityPerTag[tag] : Entity(-1);
+    entity.registry = const_cast<Registry *>(this);
+    return entity;
 }
 
 Entity Registry::GetEntityByTag(const std::string &tag) const
 {
-    return entityPerTag.at(tag);
+    return GetEntityByTag(FindTagId(tag));
 }
 
 void Registry::RemoveEntityTag(Entity entity)
 {
-    auto taggedEntity = tagPerEntity.find(entity.GetId());
-    if (taggedEntity != tagPerEntity.end())
+    if (!HasEntitySlot(entity))
+    {
+        return;
+    }
+    TagId &tag = tagPerEntity[entity.GetId()];
+    if (tag != -1)
+    {
+        if (entityPerTag[tag] == entity)
+        {
+            entityPerTag[tag] = Entity(-1);
+        }
+        tag = -1;
+    }
+}
+
+void Registry::GroupEntity(Entity entity, GroupId group)
+{
+    if (HasEntitySlot(entity) && group >= 0 && group < static_cast<int>(MAX_GROUPS))
     {
-        auto tag = taggedEntity->second;
-        entityPerTag.erase(tag);
-        tagPerEntity.erase(taggedEntity);
+        entityGroups[entity.GetId()].set(group);
     }
 }
 
 void Registry::GroupEntity(Entity entity, const std::string &group)
 {
-    entitiesPerGroup.emplace(group, std::set<Entity>());
-    entitiesPerGroup[group].emplace(entity);
-    groupPerEntity.emplace(entity.GetId(), group);
+    GroupEntity(entity, GetGroupId(group));
+}
+
+bool Registry::EntityBelongsToGroup(Entity entity, GroupId group) const
+{
+    return HasEntitySlot(entity) && group >= 0 && group < static_cast<int>(MAX_GROUPS) && entityGroups[entity.GetId()].test(group);
 }
 
 bool Registry::EntityBelongsToGroup(Entity entity, const std::string &group) const
 {
-    if (entitiesPerGroup.find(group) == entitiesPerGroup.end())
+    return EntityBelongsToGroup(entity, FindGroupId(group));
+}
+
+std::vector<Entity> Registry::GetEntitiesByGroup(GroupId group) const
+{
+    std::vector<Entity> groupEntities;
+    if (group < 0 || group >= static_cast<int>(MAX_GROUPS))
     {
-        return false;
+        return groupEntities;
+    }
+    for (int entityId = 0; entityId < static_cast<int>(entityGroups.size()); entityId++)
+    {
+        if (entityGroups[entityId].test(group))
+        {
+            Entity entity(entityId, entityGenerations.GetGeneration(entityId));
+            entity.registry = const_cast<Registry *>(this);
+            groupEntities.push_back(entity);
+        }
+    }
+    return groupEntities;
+}
+
+Entity Registry::GetEntity(EntityHandle handle)
+{
+    if (!Valid(handle))
+    {
+        return Entity(-1);
     }
-    auto groupEntities = entitiesPerGroup.at(group);
-    return groupEntities.find(entity.GetId()) != groupEntities.end();
+    Entity entity(handle & ENTITY_INDEX_MASK, handle >> ENTITY_INDEX_BITS);
+    entity.registry = this;
+    return entity;
 }
 
 std::vector<Entity> Registry::GetEntitiesByGroup(const std::string &group) const
 {
-    auto &setOfEntities = entitiesPerGroup.at(group);
-    return std::vector<Entity>(setOfEntities.begin(), setOfEntities.end());
+    return GetEntitiesByGroup(FindGroupId(group));
 }
 
 void Registry::RemoveEntityGroup(Entity entity)
 {
-    // if in group, remove entity from group management
-    auto groupedEntity = groupPerEntity.find(entity.GetId());
-    if (groupedEntity != groupPerEntity.end())
+    if (HasEntitySlot(entity))
+    {
+        entityGroups[entity.GetId()].reset();
+    }
+}
+
+PrefabId Registry::CreatePrefab()
+{
+    prefabs.emplace_back();
+    return prefabs.size() - 1;
+}
+
+void Registry::GroupPrefab(PrefabId prefab, GroupId group)
+{
+    if (group >= 0 && group < static_cast<int>(MAX_GROUPS))
     {
-        auto group = entitiesPerGroup.find(groupedEntity->second);
-        if (group != entitiesPerGroup.end())
+        prefabs[prefab].groups.set(group);
+    }
+}
+
+void Registry::GroupPrefab(PrefabId prefab, const std::string &group)
+{
+    GroupPrefab(prefab, GetGroupId(group));
+}
+
+std::vector<Entity> Registry::Instantiate(PrefabId prefab, int count)
+{
+    if (prefab < 0 || prefab >= static_cast<int>(prefabs.size()))
+    {
+        Logger::Err("Tried to instantiate an unknown prefab: " + std::to_string(prefab));
+        return {};
+    }
+    const auto signature = prefabs[prefab].signature;
+    const auto groups = prefabs[prefab].groups;
+
+    std::vector<Entity> entities = CreateEntities(count);
+    count = static_cast<int>(entities.size());
+    std::vector<int> entityIds;
+    entityIds.reserve(count);
+    for (auto entity : entities)
+    {
+        entityIds.push_back(entity.GetId());
+        entityComponentSignatures[entity.GetId()] = signature;
+        entityGroups[entity.GetId()] = groups;
+    }
+
+    // Every component is copied to all the instances in one go
+    const auto version = GetChangeVersion();
+    if (archetypes)
+    {
+        std::array<const void *, MAX_COMPONENTS> prototypes{};
+        for (unsigned int componentId = 0; componentId < MAX_COMPONENTS; componentId++)
         {
-            auto entityInGroup = group->second.find(entity);
-            if (entityInGroup != group->second.end())
+            if (signature.test(componentId))
             {
-                group->second.erase(entityInGroup);
+                prototypes[componentId] = prefabPools[componentId]->GetComponentPointer(prefab);
             }
         }
-        groupPerEntity.erase(groupedEntity);
+        archetypes->AddCopies(entityIds.data(), count, signature, prototypes, version);
+    }
+    else
+    {
+        for (unsigned int componentId = 0; componentId < MAX_COMPONENTS; componentId++)
+        {
+            if (signature.test(componentId))
+            {
+                prefabPools[componentId]->CopyInto(prefab, *componentPools[componentId], entityIds.data(), count, version);
+            }
+        }
+    }
+
+    if ((ownedComponents & signature).any())
+    {
+        for (auto entityId : entityIds)
+        {
+            AddToOwningGroups(entityId, signature);
+        }
+    }
+    if ((observedComponents[HOOK_ADDED] & signature).any())
+    {
+        for (auto entity : entities)
+        {
+            for (unsigned int componentId = 0; componentId < MAX_COMPONENTS; componentId++)
+            {
+                if (signature.test(componentId) && observedComponents[HOOK_ADDED].test(componentId))
+                {
+                    NotifyObservers(HOOK_ADDED, entity, componentId);
+                }
+            }
+        }
+    }
+    return entities;
+}
+
+// Sort a batch of entities by id and drop the duplicates
+static void SortEntityBatch(std::vector<Entity> &entities)
+{
+    std::sort(entities.begin(), entities.end());
+    entities.erase(std::unique(entities.begin(), entities.end()), entities.end());
+}
+
+DeferredEntity CommandBuffer::CreateEntity()
+{
+    DeferredEntity entity{numDeferredEntities++};
+    PushCommand(entity, nullptr);
+    return entity;
+}
+
+DeferredEntity CommandBuffer::Instantiate(PrefabId prefab)
+{
+    DeferredEntity entity = CreateEntity();
+    commands.back().prefab = prefab;
+    return entity;
+}
+
+CommandBuffer &Registry::GetCommandBuffer()
+{
+    const auto threadId = std::this_thread::get_id();
+    std::lock_guard<std::mutex> lock(commandBuffersMutex);
+    for (auto &commandBuffer : commandBuffers)
+    {
+        if (commandBuffer.first == threadId)
+        {
+            return *commandBuffer.second;
+        }
+    }
+    commandBuffers.emplace_back(threadId, std::make_unique<CommandBuffer>());
+    return *commandBuffers.back().second;
+}
+
+void Registry::FlushCommandBuffers()
+{
+    struct CommandRef
+    {
+        int sortKey;
+        int source;
+        int buffer;
+        int index;
+    };
+
+    // Order all the recorded commands by sort key and source, keeping the recording order within each buffer
+    std::vector<CommandRef> orderedCommands;
+    std::vector<std::vector<Entity>> deferredEntities(commandBuffers.size());
+    for (size_t i = 0; i < commandBuffers.size(); i++)
+    {
+        const auto &commands = commandBuffers[i].second->commands;
+        for (size_t j = 0; j < commands.size(); j++)
+        {
+            orderedCommands.push_back({commands[j].sortKey, commands[j].source, static_cast<int>(i), static_cast<int>(j)});
+        }
+        deferredEntities[i].resize(commandBuffers[i].second->numDeferredEntities, Entity(-1));
+    }
+    if (orderedCommands.empty())
+    {
+        return;
+    }
+    std::stable_sort(orderedCommands.begin(), orderedCommands.end(), [](const CommandRef &a, const CommandRef &b)
+                     { return a.sortKey != b.sortKey ? a.sortKey < b.sortKey : a.source < b.source; });
+
+    // Create the deferred entities first so the other commands can refer to them
+    for (const auto &ref : orderedCommands)
+    {
+        const auto &command = commandBuffers[ref.buffer].second->commands[ref.index];
+        if (!command.apply && command.prefab < 0)
+        {
+            deferredEntities[ref.buffer][command.deferredIndex] = CreateEntity();
+        }
+        else if (!command.apply)
+        {
+            // An unknown prefab leaves the deferred entity invalid, so its other commands are skipped
+            const auto instances = Instantiate(command.prefab);
+            if (!instances.empty())
+            {
+                deferredEntities[ref.buffer][command.deferredIndex] = instances[0];
+            }
+        }
+    }
+
+    for (const auto &ref : orderedCommands)
+    {
+        auto &command = commandBuffers[ref.buffer].second->commands[ref.index];
+        if (!command.apply)
+        {
+            continue;
+        }
+        Entity entity = command.deferredIndex >= 0 ? deferredEntities[ref.buffer][command.deferredIndex] : command.target;
+        entity.registry = this;
+
+        // The entity may have been killed since the command was recorded
+        if (Valid(entity))
+        {
+            command.apply(*this, entity);
+        }
+    }
+
+    for (auto &commandBuffer : commandBuffers)
+    {
+        commandBuffer.second->commands.clear();
+        commandBuffer.second->numDeferredEntities = 0;
     }
 }
 
 void Registry::Update()
 {
+    // Apply the structural changes recorded in the command buffers since the last update
+    FlushCommandBuffers();
+
     // Processing the entities that are waiting to be created to the active Systems
+    // Consecutive entities usually share the same signature, so the interested systems are only looked up once per run
+    SortEntityBatch(entitiesToBeAdded);
+    const std::vector<System *> *interestedSystems = nullptr;
+    Signature batchSignature;
     for (auto entity : entitiesToBeAdded)
     {
-        AddEntityToSystems(entity);
+        const auto entityId = entity.GetId();
+        const auto &entitySignature = entityComponentSignatures[entityId];
+        if (!interestedSystems || entitySignature != batchSignature)
+        {
+            batchSignature = entitySignature;
+            interestedSystems = &GetSystemsForSignature(batchSignature);
+        }
+        for (auto system : *interestedSystems)
+        {
+            system->AddEntity(entity);
+        }
+
+        if (entityId >= static_cast<int>(entitySystemSignatures.size()))
+        {
+            entitySystemSignatures.resize(entityId + 1);
+        }
+        entitySystemSignatures[entityId] = entitySignature;
     }
     entitiesToBeAdded.clear();
 
     // Process the entities that are waiting to be killed from the active Systems
+    SortEntityBatch(entitiesToBeKilled);
     for (auto entity : entitiesToBeKilled)
     {
+        const auto entityId = entity.GetId();
         RemoveEntityFromSystems(entity);
-        entityComponentSignatures[entity.GetId()].reset();
 
-        // Remove entity from component pools
-        for (auto pool : componentPools)
+        // Let the observers see the components before they are destroyed
+        const auto observedSignature = entityComponentSignatures[entityId] & observedComponents[HOOK_REMOVED];
+        if (observedSignature.any())
         {
-            if (pool)
+            for (unsigned int componentId = 0; componentId < MAX_COMPONENTS; componentId++)
             {
-                pool->RemoveEntityFromPool(entity.GetId());
+                if (observedSignature.test(componentId))
+                {
+                    NotifyObservers(HOOK_REMOVED, entity, componentId);
+                }
             }
         }
 
-        // Make the entity id available to be reused
-        freeIds.push_back(entity.GetId());
+        // Remove entity from the component pools it has components in (or from its archetype chunk)
+        const auto entitySignature = entityComponentSignatures[entityId];
+        if ((entitySignature & ownedComponents).any())
+        {
+            RemoveFromOwningGroups(entityId, entitySignature);
+        }
+        entityComponentSignatures[entityId].reset();
+        if (archetypes)
+        {
+            archetypes->RemoveEntity(entityId);
+        }
+        else
+        {
+            for (unsigned int componentId = 0; componentId < MAX_COMPONENTS; componentId++)
+            {
+                if (entitySignature.test(componentId))
+                {
+                    componentPools[componentId]->RemoveEntityFromPool(entityId);
+                }
+            }
+        }
+
+        // Make the entity id available to be reused (handles to the killed entity become invalid)
+        entityGenerations.Release(entityId);
+        freeIds.push_back(entityId);
 
         // Remove any traces of that entity from the tag/group maps
         RemoveEntityTag(entity);
@@ -191,24 +986,259 @@ void Registry::Update()
     entitiesToBeKilled.clear();
 }
 
-void Registry::AddEntityToSystems(Entity entity)
+const std::vector<System *> &Registry::GetSystemsForSignature(const Signature &signature)
 {
-    const auto entityId = entity.GetId();
-    const auto entitySignature = entityComponentSignatures[entityId];
+    auto cached = systemsPerSignature.find(signature);
+    if (cached != systemsPerSignature.end())
+    {
+        return cached->second;
+    }
+
+    std::vector<System *> &interestedSystems = systemsPerSignature[signature];
     for (auto &system : systems)
     {
         const auto &systemSignature = system.second->GetComponentsSignature();
-        if ((entitySignature & systemSignature) == systemSignature)
+        if ((signature & systemSignature) == systemSignature)
         {
-            system.second->AddEntity(entity);
+            interestedSystems.push_back(system.second.get());
         }
     }
+    return interestedSystems;
+}
+
+void Registry::AddEntityToSystems(Entity entity)
+{
+    const auto entityId = entity.GetId();
+    const auto &entitySignature = entityComponentSignatures[entityId];
+    for (auto system : GetSystemsForSignature(entitySignature))
+    {
+        system->AddEntity(entity);
+    }
+
+    if (entityId >= static_cast<int>(entitySystemSignatures.size()))
+    {
+        entitySystemSignatures.resize(entityId + 1);
+    }
+    entitySystemSignatures[entityId] = entitySignature;
 }
 
 void Registry::RemoveEntityFromSystems(Entity entity)
 {
-    for (auto &system : systems)
+    const auto entityId = entity.GetId();
+    if (entityId >= static_cast<int>(entitySystemSignatures.size()))
+    {
+        return;
+    }
+    for (auto system : GetSystemsForSignature(entitySystemSignatures[entityId]))
+    {
+        system->RemoveEntity(entity);
+    }
+    entitySystemSignatures[entityId].reset();
+}
+
+void Registry::BuildScheduleStages()
+{
+    // Each system goes in the stage right after the last earlier system it conflicts with
+    std::vector<int> stagePerSystem(schedule.size(), 0);
+    for (size_t i = 0; i < schedule.size(); i++)
+    {
+        for (size_t j = 0; j < i; j++)
+        {
+            if (schedule[i].system->ConflictsWith(*schedule[j].system))
+            {
+                stagePerSystem[i] = std::max(stagePerSystem[i], stagePerSystem[j] + 1);
+            }
+        }
+        if (stagePerSystem[i] >= static_cast<int>(scheduleStages.size()))
+        {
+            scheduleStages.resize(stagePerSystem[i] + 1);
+        }
+        scheduleStages[stagePerSystem[i]].push_back(i);
+    }
+}
+
+void Registry::UnscheduleSystem(System *system)
+{
+    schedule.erase(
+        std::remove_if(
+            schedule.begin(), schedule.end(),
+            [system](const ScheduledSystem &scheduledSystem)
+            { return scheduledSystem.system == system; }),
+        schedule.end());
+    scheduleStages.clear();
+}
+
+void Registry::RunScheduledSystems(JobSystem &jobSystem)
+{
+    if (scheduleStages.empty())
+    {
+        BuildScheduleStages();
+    }
+
+    for (const auto &stage : scheduleStages)
+    {
+        // A stage with a single system runs directly on the calling thread
+        if (stage.size() == 1)
+        {
+            RunScheduledSystem(stage[0]);
+            continue;
+        }
+
+        JobCounter counter;
+        for (auto index : stage)
+        {
+            jobSystem.Submit(counter, [this, index]
+                             { RunScheduledSystem(index); });
+        }
+        jobSystem.Wait(counter);
+    }
+}
+
+void Registry::RunScheduledSystem(int index)
+{
+    // Tag the commands of the system with its position in the schedule (0 is left for unscheduled code)
+    auto &commands = GetCommandBuffer();
+    commands.SetSource(index + 1);
+    schedule[index].update();
+    commands.SetSource(0);
+}
+
+std::vector<ComponentStats> Registry::GetComponentStats() const
+{
+    std::vector<ComponentStats> stats;
+    for (unsigned int componentId = 0; componentId < MAX_COMPONENTS; componentId++)
+    {
+        if (archetypes && archetypes->IsRegistered(componentId))
+        {
+            stats.push_back(archetypes->GetStats(componentId));
+        }
+        else if (!archetypes && componentPools[componentId])
+        {
+            stats.push_back(componentPools[componentId]->GetStats());
+        }
+    }
+    return stats;
+}
+
+std::vector<SystemStats> Registry::GetSystemStats() const
+{
+    std::vector<SystemStats> stats;
+    for (const auto &system : systems)
+    {
+        stats.push_back({GetTypeName(system.first.name()), static_cast<int>(system.second->GetSystemEntities().size())});
+    }
+    std::sort(stats.begin(), stats.end(), [](const SystemStats &a, const SystemStats &b)
+              { return a.name < b.name; });
+    return stats;
+}
+
+bool Registry::DumpStats(const std::string &filePath) const
+{
+    std::ofstream file(filePath);
+    if (!file)
+    {
+        Logger::Err("Could not open the stats file " + filePath);
+        return false;
+    }
+
+    file << "component,element size,count,capacity,bytes,grow events,peak\n";
+    for (const auto &component : GetComponentStats())
+    {
+        file << component.name << "," << component.elementSize << "," << component.count << "," << component.capacity << ","
+             << component.bytes << "," << component.growEvents << "," << component.peakCount << "\n";
+    }
+    file << "\nsystem,entities\n";
+    for (const auto &system : GetSystemStats())
+    {
+        file << system.name << "," << system.numEntities << "\n";
+    }
+
+    Logger::Log("Registry stats written to " + filePath);
+    return true;
+}
+
+void *Registry::GetComponentPointer(int entityId, int componentId) const
+{
+    if (archetypes)
+    {
+        return archetypes->GetComponentPointer(entityId, componentId);
+    }
+    return componentPools[componentId]->GetComponentPointer(entityId);
+}
+
+void Registry::NotifyObservers(ObserverHook hook, Entity entity, int componentId)
+{
+    entity.registry = this;
+    // Observers can add or remove observers, so the list is indexed again on every call (the ones
+    // added meanwhile only see the next notification)
+    const auto &observers = componentObservers[hook][componentId];
+    const size_t numObservers = observers.size();
+    for (size_t i = 0; i < numObservers && i < observers.size(); i++)
     {
-        system.second->RemoveEntity(entity);
+        const ComponentObserver observer = observers[i];
+        observer.invoke(observer.owner, entity, GetComponentPointer(entity.GetId(), componentId));
     }
-}
\ No newline at end of file
+}
+
+void Registry::RemoveObservers(const void *owner)
+{
+    for (int hook = 0; hook < NUM_OBSERVER_HOOKS; hook++)
+    {
+        for (unsigned int componentId = 0; componentId < MAX_COMPONENTS; componentId++)
+        {
+            auto &observers = componentObservers[hook][componentId];
+            observers.erase(
+                std::remove_if(
+                    observers.begin(), observers.end(),
+                    [owner](const ComponentObserver &observer)
+                    { return observer.owner == owner; }),
+                observers.end());
+            observedComponents[hook].set(componentId, !observers.empty());
+        }
+    }
+}
+
+bool Registry::IsInOwningGroup(const OwningGroupData &group, int entityId) const
+{
+    // Members are always the first entries of the group pools
+    return componentPools[group.componentIds[0]]->GetIndexOf(entityId) < group.size;
+}
+
+void Registry::AddToOwningGroups(int entityId, const Signature &addedSignature)
+{
+    const auto &entitySignature = entityComponentSignatures[entityId];
+    for (auto &group : owningGroups)
+    {
+        if ((group->signature & addedSignature).none() || (entitySignature & group->signature) != group->signature || IsInOwningGroup(*group, entityId))
+        {
+            continue;
+        }
+
+        // Swap the entity right after the last member in every pool of the group
+        for (auto componentId : group->componentIds)
+        {
+            auto &pool = *componentPools[componentId];
+            pool.SwapIndices(pool.GetIndexOf(entityId), group->size);
+        }
+        group->size++;
+    }
+}
+
+void Registry::RemoveFromOwningGroups(int entityId, const Signature &removedSignature)
+{
+    for (auto &group : owningGroups)
+    {
+        if ((group->signature & removedSignature).none() || (entityComponentSignatures[entityId] & group->signature) != group->signature || !IsInOwningGroup(*group, entityId))
+        {
+            continue;
+        }
+
+        // Swap the entity with the last member in every pool of the group and shrink it
+        group->size--;
+        for (auto componentId : group->componentIds)
+        {
+            auto &pool = *componentPools[componentId];
+            pool.SwapIndices(pool.GetIndexOf(entityId), group->size);
+        }
+    }
+}
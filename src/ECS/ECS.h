@@ -5,42 +5,138 @@
 #include <vector>
 #include <unordered_map>
 #include <typeindex>
-#include <set>
 #include <memory>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <deque>
+#include <tuple>
+#include <array>
+#include <new>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <string>
+#include <typeinfo>
 #include "../Logger/Logger.h"
+#include "../Jobs/JobSystem.h"
+#include "../Components/Components.h"
 
-const unsigned int MAX_COMPONENTS = 32;
+// The signature has one bit per registered component type
+const unsigned int MAX_COMPONENTS = GameComponents::size;
 typedef std::bitset<MAX_COMPONENTS> Signature;
 
-struct IComponent
-{
-protected:
-    static int nextId;
-};
+// Tags and groups are interned once (Registry::GetTagId/GetGroupId) and then handled as small integer ids
+typedef int TagId;
+typedef int GroupId;
+const unsigned int MAX_GROUPS = 32;
+typedef std::bitset<MAX_GROUPS> GroupMask;
+
+// Prefabs are prebuilt sets of components, identified by the id returned by Registry::CreatePrefab
+typedef int PrefabId;
 
 template <typename T>
-class Component : public IComponent
+class Component
 {
 public:
-    static int GetId()
+    static constexpr int GetId()
     {
-        static auto id = nextId++;
+        constexpr int id = GameComponents::IndexOf<T>();
+        static_assert(id != -1, "Component type is not listed in GameComponents (Components/Components.h)");
         return id;
     }
+};
+
+// View filter that only matches the entities whose T component changed after a given version.
+// Only adding, replacing or MarkChanged<T>() count as a change: fetching a component does not, as
+// GetComponent hands out the same mutable reference to readers and writers (bumping the version
+// there would mark every read component as changed, and would write the pool from reading systems)
+template <typename T>
+struct Changed
+{
+};
+
+// Component type behind a view parameter (T or Changed<T>)
+template <typename T>
+struct ComponentOf
+{
+    typedef T type;
+    static constexpr bool isChangedFilter = false;
+};
+
+template <typename T>
+struct ComponentOf<Changed<T>>
+{
+    typedef T type;
+    static constexpr bool isChangedFilter = true;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Entity handles
+////////////////////////////////////////////////////////////////////////////////
+// A handle packs the entity index (its id) in the low bits and the generation
+// of that index in the high bits. The generation changes every time the index
+// is freed, so a handle kept after its entity was killed is detected as stale
+// instead of silently addressing the entity that reused the index
+////////////////////////////////////////////////////////////////////////////////
+typedef std::uint32_t EntityHandle;
+const int ENTITY_INDEX_BITS = 20;
+const std::uint32_t ENTITY_INDEX_MASK = (1u << ENTITY_INDEX_BITS) - 1;
+const std::uint32_t ENTITY_GENERATION_MASK = (1u << (32 - ENTITY_INDEX_BITS)) - 1;
+// The last index is reserved so the invalid handle never matches a live entity
+const int MAX_ENTITIES = ENTITY_INDEX_MASK;
+const EntityHandle INVALID_ENTITY_HANDLE = 0xFFFFFFFF;
+
+// Generation and liveness of every entity index, kept in fixed pages of atomics
+// that never move so any thread can validate handles while the main thread
+// creates and kills entities
+class EntityGenerations
+{
+private:
+    static const int PAGE_SIZE = 4096;
+    static const int NUM_PAGES = (MAX_ENTITIES + PAGE_SIZE - 1) / PAGE_SIZE;
+    static const std::uint32_t ALIVE_FLAG = 1u << 31;
+
+    std::array<std::atomic<std::atomic<std::uint32_t> *>, NUM_PAGES> pages{};
 
-    Component(int id) : id(id)
+    std::atomic<std::uint32_t> *GetSlot(int index) const
     {
+        if (index < 0 || index >= MAX_ENTITIES)
+        {
+            return nullptr;
+        }
+        auto page = pages[index / PAGE_SIZE].load(std::memory_order_acquire);
+        return page ? &page[index % PAGE_SIZE] : nullptr;
     }
 
-private:
-    int id;
+public:
+    EntityGenerations() = default;
+    EntityGenerations(const EntityGenerations &) = delete;
+    EntityGenerations &operator=(const EntityGenerations &) = delete;
+    ~EntityGenerations();
+
+    // Mark an index as used by a live entity (main thread only)
+    void Activate(int index);
+    // Mark an index as free and bump its generation (main thread only)
+    void Release(int index);
+
+    std::uint32_t GetGeneration(int index) const
+    {
+        const auto slot = GetSlot(index);
+        return slot ? slot->load(std::memory_order_acquire) & ENTITY_GENERATION_MASK : 0;
+    }
+
+    bool IsAlive(int index, std::uint32_t generation) const
+    {
+        const auto slot = GetSlot(index);
+        return slot && slot->load(std::memory_order_acquire) == (generation | ALIVE_FLAG);
+    }
 };
 
 class Entity
 {
 public:
-    Entity(int id) : id(id)
+    Entity(int id, std::uint32_t generation = 0) : id(id), generation(generation)
     {
     }
 
@@ -52,49 +148,82 @@ public:
         return id;
     }
 
-    // Manage entity tags and groups
+    std::uint32_t GetGeneration() const
+    {
+        return generation;
+    }
+
+    // Compact handle of the entity that can be stored and checked with Registry::Valid()
+    EntityHandle GetHandle() const
+    {
+        return (static_cast<std::uint32_t>(id) & ENTITY_INDEX_MASK) | (generation << ENTITY_INDEX_BITS);
+    }
+
+    // False once the entity was killed (and its id possibly reused)
+    bool IsValid() const;
+
+    // Manage entity tags and groups (the string overloads are meant for Lua and tooling)
+    void Tag(TagId tag);
     void Tag(const std::string &tag);
+    bool HasTag(TagId tag) const;
     bool HasTag(const std::string &tag) const;
+    void Group(GroupId group);
     void Group(const std::string &group);
+    bool BelongsToGroup(GroupId group) const;
     bool BelongsToGroup(const std::string &group) const;
 
     template <typename TComponrnt, typename... TArgs>
     void AddComponent(TArgs &&...args);
+    template <typename... TComponents>
+    void AddComponents(TComponents &&...components);
     template <typename TComponrnt>
     void RemoveComponent();
     template <typename TComponrnt>
     bool HasComponent() const;
     template <typename TComponrnt>
     TComponrnt &GetComponent() const;
+    template <typename TComponent>
+    void MarkChanged() const;
 
     Entity &operator=(const Entity &other) = default;
 
     bool operator==(const Entity &other) const
     {
-        return id == other.id;
+        return id == other.id && generation == other.generation;
     }
 
     bool operator!=(const Entity &other) const
     {
-        return id != other.id;
+        return !(*this == other);
     }
 
+    // Ordered by id and then by generation, consistently with ==
     bool operator<(const Entity &other) const
     {
-        return id < other.id;
+        return id != other.id ? id < other.id : generation < other.generation;
     }
 
     bool operator>(const Entity &other) const
     {
-        return id > other.id;
+        return other < *this;
     }
 
-    class Registry *registry;
+    class Registry *registry = nullptr;
 
 private:
     int id;
+    std::uint32_t generation;
 };
 
+// Shared state other than components that systems can declare access to
+enum SystemResource
+{
+    RESOURCE_ENTITIES, // Creating and killing entities, changing tags and groups
+    RESOURCE_CAMERA,
+    MAX_RESOURCES
+};
+typedef std::bitset<MAX_RESOURCES> ResourceMask;
+
 class System
 {
 public:
@@ -103,29 +232,90 @@ public:
 
     void AddEntity(Entity entity);
     void RemoveEntity(Entity entity);
-    std::vector<Entity> GetSystemEntities() const;
+    bool HasEntity(Entity entity) const;
+    const std::vector<Entity> &GetSystemEntities() const;
     const Signature GetComponentsSignature() const;
 
+    // Two systems conflict (and cannot run at the same time) if one writes something the other accesses
+    bool ConflictsWith(const System &other) const;
+
+    // Required components are also read by the system
     template <typename TComponrnt>
     void RequireComponent();
 
+protected:
+    // Access declarations used by the scheduler to run systems concurrently
+    template <typename TComponent>
+    void ReadsComponent();
+    template <typename TComponent>
+    void WritesComponent();
+    void ReadsResource(SystemResource resource);
+    void WritesResource(SystemResource resource);
+    // For systems whose side effects cannot be described (event emitters, scripts)
+    void RequireExclusiveAccess();
+
 private:
     Signature componentSignature;
+
+    Signature componentReads;
+    Signature componentWrites;
+    ResourceMask resourceReads;
+    ResourceMask resourceWrites;
+    bool isExclusive = false;
+
+    // Packed list of entities plus the index of each entity id in it (-1 if the entity is not in the system)
     std::vector<Entity> entities;
+    std::vector<int> entityIndices;
+};
+
+// Memory and occupancy of the storage of one component type (see Registry::GetComponentStats)
+struct ComponentStats
+{
+    std::string name;
+    size_t elementSize = 0;
+    int count = 0;
+    // Number of components that fit in the allocated storage
+    int capacity = 0;
+    // Bytes held by the storage, including its entity id and version arrays
+    size_t bytes = 0;
+    // Times the storage had to allocate more memory (pool reallocations or new archetype chunks)
+    int growEvents = 0;
+    int peakCount = 0;
+};
+
+struct SystemStats
+{
+    std::string name;
+    int numEntities = 0;
 };
 
+// Readable name of a type for tooling (demangled when the compiler supports it)
+std::string GetTypeName(const char *mangledName);
+
 ////////////////////////////////////////////////////////////////////////////////
 // Pool
 ////////////////////////////////////////////////////////////////////////////////
-// A pool is just a vector (contiguous data) of objects of type T
+// A pool is just a vector (contiguous data) of objects of type T, kept packed
+// as a sparse set: a paged sparse array maps entity ids to dense indices and a
+// dense array maps each index back to its entity id
 ////////////////////////////////////////////////////////////////////////////////
 class IPool
 {
 public:
     virtual ~IPool() = default;
     virtual void RemoveEntityFromPool(int entityId) = 0;
+    virtual void *GetComponentPointer(int entityId) = 0;
+    // Used by owning groups to keep their members packed at the front of the pool
+    virtual int GetIndexOf(int entityId) const = 0;
+    virtual void SwapIndices(int indexA, int indexB) = 0;
+    // Appends a copy of the component of sourceEntityId to another pool of the same type (used by prefabs)
+    virtual void CopyInto(int sourceEntityId, IPool &destination, const int *entityIds, int count, std::uint32_t version) const = 0;
+    virtual ComponentStats GetStats() const = 0;
 };
 
+// Number of entity ids covered by each page of the sparse array
+const int SPARSE_PAGE_SIZE = 1024;
+
 template <typename T>
 class Pool : public IPool
 {
@@ -134,15 +324,57 @@ private:
     std::vector<T> data;
     int size;
 
-    // Helper maps to keep track of entity ids per index, so the vector is always packed
-    std::unordered_map<int, int> entityIdToIndex;
-    std::unordered_map<int, int> indexToEntityId;
+    // Dense index -> entity id, packed in the same order as the data vector
+    std::vector<int> indexToEntityId;
+
+    // Dense index -> change version of the component, packed like the data vector
+    std::vector<std::uint32_t> versions;
+
+    // Entity id -> dense index, split in fixed pages allocated on demand (-1 means no component)
+    std::vector<std::unique_ptr<int[]>> entityIdToIndex;
+
+    // Instrumentation: number of reallocations of the data vector and largest size reached
+    int growEvents = 0;
+    int peakSize = 0;
+
+    void Reserve(int capacity)
+    {
+        data.reserve(capacity);
+        growEvents++;
+    }
+
+    int *GetSparseSlot(int entityId) const
+    {
+        const size_t page = entityId / SPARSE_PAGE_SIZE;
+        if (page >= entityIdToIndex.size() || !entityIdToIndex[page])
+        {
+            return nullptr;
+        }
+        return &entityIdToIndex[page][entityId % SPARSE_PAGE_SIZE];
+    }
+
+    int &GetOrCreateSparseSlot(int entityId)
+    {
+        const size_t page = entityId / SPARSE_PAGE_SIZE;
+        if (page >= entityIdToIndex.size())
+        {
+            entityIdToIndex.resize(page + 1);
+        }
+        if (!entityIdToIndex[page])
+        {
+            entityIdToIndex[page].reset(new int[SPARSE_PAGE_SIZE]);
+            std::fill_n(entityIdToIndex[page].get(), SPARSE_PAGE_SIZE, -1);
+        }
+        return entityIdToIndex[page][entityId % SPARSE_PAGE_SIZE];
+    }
 
 public:
     Pool(int capacity = 100)
     {
         size = 0;
-        data.resize(capacity);
+        data.reserve(capacity);
+        indexToEntityId.reserve(capacity);
+        versions.reserve(capacity);
     }
 
     virtual ~Pool() = default;
@@ -162,210 +394,1317 @@ public:
         data.clear();
         entityIdToIndex.clear();
         indexToEntityId.clear();
+        versions.clear();
         size = 0;
     }
 
-    void Set(int entityId, T object)
+    bool Contains(int entityId) const
     {
-        if (entityIdToIndex.find(entityId) != entityIdToIndex.end())
+        const int *slot = GetSparseSlot(entityId);
+        return slot && *slot != -1;
+    }
+
+    int GetIndex(int entityId) const
+    {
+        return entityIdToIndex[entityId / SPARSE_PAGE_SIZE][entityId % SPARSE_PAGE_SIZE];
+    }
+
+    int GetEntityId(int index) const
+    {
+        return indexToEntityId[index];
+    }
+
+    const std::vector<int> &GetEntityIds() const
+    {
+        return indexToEntityId;
+    }
+
+    // Constructs the component in place (or replaces the existing one) and returns it
+    template <typename... TArgs>
+    T &Emplace(int entityId, TArgs &&...args)
+    {
+        int &index = GetOrCreateSparseSlot(entityId);
+        if (index != -1)
         {
             // If the element already exists, simply replace the component object
-            int index = entityIdToIndex[entityId];
-            data[index] = object;
+            data[index] = T(std::forward<TArgs>(args)...);
         }
         else
         {
             // When adding a new object, we keep track of the entity ids and their vector index
-            int index = size;
-            entityIdToIndex.emplace(entityId, index);
-            indexToEntityId.emplace(index, entityId);
-            if (index >= static_cast<int>(data.capacity()))
+            index = size;
+            if (size == static_cast<int>(data.capacity()))
             {
-                // If necessary, we resize by always doubling the current capacity
-                data.resize(size * 2);
+                // If necessary, we grow by always doubling the current capacity
+                Reserve(size > 0 ? size * 2 : 1);
             }
-            data[index] = object;
+            data.emplace_back(std::forward<TArgs>(args)...);
+            indexToEntityId.push_back(entityId);
+            versions.push_back(0);
             size++;
+            peakSize = std::max(peakSize, size);
+        }
+        return data[index];
+    }
+
+    // Appends a copy of the prototype for each entity (none of them can have the component yet)
+    void EmplaceCopies(const int *entityIds, int count, const T &prototype, std::uint32_t version)
+    {
+        if (size + count > static_cast<int>(data.capacity()))
+        {
+            Reserve(std::max(size * 2, size + count));
+        }
+        data.insert(data.end(), count, prototype);
+        indexToEntityId.insert(indexToEntityId.end(), entityIds, entityIds + count);
+        versions.insert(versions.end(), count, version);
+        for (int i = 0; i < count; i++)
+        {
+            GetOrCreateSparseSlot(entityIds[i]) = size + i;
         }
+        size += count;
+        peakSize = std::max(peakSize, size);
+    }
+
+    void Set(int entityId, T object)
+    {
+        Emplace(entityId, std::move(object));
     }
 
     void Remove(int entityId)
     {
-        // Copy the last element to the deleted position to keep the array packed
-        int indexOfRemoved = entityIdToIndex[entityId];
+        // Move the last element to the deleted position to keep the array packed
+        int &indexOfRemoved = entityIdToIndex[entityId / SPARSE_PAGE_SIZE][entityId % SPARSE_PAGE_SIZE];
         int indexOfLast = size - 1;
-        data[indexOfRemoved] = data[indexOfLast];
-
-        // Update the index-entity maps to point to the correct elements
-        int entityIdOfLastElement = indexToEntityId[indexOfLast];
-        entityIdToIndex[entityIdOfLastElement] = indexOfRemoved;
-        indexToEntityId[indexOfRemoved] = entityIdOfLastElement;
+        if (indexOfRemoved != indexOfLast)
+        {
+            data[indexOfRemoved] = std::move(data[indexOfLast]);
+            versions[indexOfRemoved] = versions[indexOfLast];
 
-        entityIdToIndex.erase(entityId);
-        indexToEntityId.erase(indexOfLast);
+            // Update the index-entity mappings to point to the correct elements
+            int entityIdOfLastElement = indexToEntityId[indexOfLast];
+            entityIdToIndex[entityIdOfLastElement / SPARSE_PAGE_SIZE][entityIdOfLastElement % SPARSE_PAGE_SIZE] = indexOfRemoved;
+            indexToEntityId[indexOfRemoved] = entityIdOfLastElement;
+        }
+        data.pop_back();
+        indexToEntityId.pop_back();
+        versions.pop_back();
+        indexOfRemoved = -1;
 
         size--;
     }
 
     void RemoveEntityFromPool(int entityId) override
     {
-        if (entityIdToIndex.find(entityId) != entityIdToIndex.end())
+        if (Contains(entityId))
         {
             Remove(entityId);
         }
     }
 
-    T &Get(int entityId)
+    void *GetComponentPointer(int entityId) override
     {
-        int index = entityIdToIndex[entityId];
-        return static_cast<T &>(data[index]);
+        return &Get(entityId);
     }
 
-    T &operator[](unsigned int index)
+    int GetIndexOf(int entityId) const override
     {
-        return data[index];
+        return GetIndex(entityId);
     }
-};
 
-class Registry
-{
-public:
-    Registry()
+    // Exchange the components (and owners) of two dense indices
+    void SwapIndices(int indexA, int indexB) override
     {
-        Logger::Log("Registry created");
-    };
-    ~Registry()
+        if (indexA == indexB)
+        {
+            return;
+        }
+        std::swap(data[indexA], data[indexB]);
+        std::swap(versions[indexA], versions[indexB]);
+        std::swap(indexToEntityId[indexA], indexToEntityId[indexB]);
+        const int entityIdA = indexToEntityId[indexA];
+        const int entityIdB = indexToEntityId[indexB];
+        entityIdToIndex[entityIdA / SPARSE_PAGE_SIZE][entityIdA % SPARSE_PAGE_SIZE] = indexA;
+        entityIdToIndex[entityIdB / SPARSE_PAGE_SIZE][entityIdB % SPARSE_PAGE_SIZE] = indexB;
+    }
+
+    void CopyInto(int sourceEntityId, IPool &destination, const int *entityIds, int count, std::uint32_t version) const override
     {
-        Logger::Log("Registry destroyed");
-    };
+        static_cast<Pool<T> &>(destination).EmplaceCopies(entityIds, count, data[GetIndex(sourceEntityId)], version);
+    }
 
-    Entity CreateEntity();
-    void KillEntity(Entity entity);
+    ComponentStats GetStats() const override
+    {
+        ComponentStats stats;
+        stats.name = GetTypeName(typeid(T).name());
+        stats.elementSize = sizeof(T);
+        stats.count = size;
+        stats.capacity = static_cast<int>(data.capacity());
+        stats.bytes = data.capacity() * sizeof(T) + indexToEntityId.capacity() * sizeof(int) + versions.capacity() * sizeof(std::uint32_t);
+        for (const auto &page : entityIdToIndex)
+        {
+            stats.bytes += page ? SPARSE_PAGE_SIZE * sizeof(int) : 0;
+        }
+        stats.growEvents = growEvents;
+        stats.peakCount = peakSize;
+        return stats;
+    }
 
-    // Tag management
-    void TagEntity(Entity entity, const std::string &tag);
-    bool EntityHasTag(Entity entity, const std::string &tag) const;
-    Entity GetEntityByTag(const std::string &tag) const;
-    void RemoveEntityTag(Entity entity);
+    T &Get(int entityId)
+    {
+        return data[GetIndex(entityId)];
+    }
 
-    // Group management
-    void GroupEntity(Entity entity, const std::string &group);
-    bool EntityBelongsToGroup(Entity entity, const std::string &group) const;
-    std::vector<Entity> GetEntitiesByGroup(const std::string &group) const;
-    void RemoveEntityGroup(Entity entity);
+    // Change version of the component of an entity (the registry version when it was last added or marked)
+    std::uint32_t GetVersion(int entityId) const
+    {
+        return versions[GetIndex(entityId)];
+    }
 
-    void Update();
-    void AddEntityToSystem(Entity entity, System *system);
-    void RemoveEntityFromSystem(Entity entity, System *system);
+    void MarkChanged(int entityId, std::uint32_t version)
+    {
+        versions[GetIndex(entityId)] = version;
+    }
 
-    template <typename TComponrnt, typename... TArgs>
-    void AddComponent(Entity entity, TArgs &&...args);
-    template <typename TComponrnt>
-    void RemoveComponent(Entity entity);
-    template <typename TComponrnt>
-    bool HasComponent(Entity entity) const;
-    template <typename TComponrnt>
-    TComponrnt &GetComponent(Entity entity) const;
+    T &operator[](unsigned int index)
+    {
+        return data[index];
+    }
 
-    template <typename TSystem, typename... TArgs>
-    void AddSystem(TArgs &&...args);
-    template <typename TSystem>
-    void RemoveSystem();
-    template <typename TSystem>
-    bool HasSystem() const;
-    template <typename TSystem>
-    TSystem &GetSystem() const;
+    // Iterate the packed component data directly (use GetEntityId to find the owner of each index)
+    T *begin()
+    {
+        return data.data();
+    }
 
-    void AddEntityToSystems(Entity entity);
-    void RemoveEntityFromSystems(Entity entity);
+    T *end()
+    {
+        return data.data() + size;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Archetypes
+////////////////////////////////////////////////////////////////////////////////
+// Optional storage backend where all the entities that share the same
+// signature live together in fixed-size chunks. Each chunk stores one column
+// per component type, so iterating several components walks memory linearly.
+// Adding or removing a component moves the entity to another archetype, so
+// component references are only valid until the next structural change
+////////////////////////////////////////////////////////////////////////////////
+enum class StorageMode
+{
+    Pools,
+    Archetypes
+};
+
+// Size in bytes of each archetype chunk
+const int ARCHETYPE_CHUNK_SIZE = 16 * 1024;
 
+// Type-erased operations needed to move component objects between chunks
+struct ComponentInfo
+{
+    size_t size = 0;
+    size_t alignment = 0;
+    void (*relocate)(void *destination, void *source) = nullptr;
+    void (*destroy)(void *object) = nullptr;
+    void (*copy)(void *destination, const void *source) = nullptr;
+    const std::type_info *type = nullptr;
+};
+
+class Archetype
+{
 private:
-    int numEntities = 0;
-    std::vector<std::shared_ptr<IPool>> componentPools;
-    std::vector<Signature> entityComponentSignatures;
-    std::unordered_map<std::type_index, std::shared_ptr<System>> systems;
+    struct Chunk
+    {
+        std::unique_ptr<unsigned char[]> memory;
+        int count = 0;
+        // Latest change version of each component column (atomic since rows of a chunk can be marked from several threads)
+        std::unique_ptr<std::atomic<std::uint32_t>[]> versions;
+    };
 
-    std::set<Entity> entitiesToBeAdded;
-    std::set<Entity> entitiesToBeKilled;
+    Signature signature;
+    const std::array<ComponentInfo, MAX_COMPONENTS> &componentInfos;
+    std::vector<int> componentIds;
+    std::array<int, MAX_COMPONENTS> columnOffsets;
+    std::vector<Chunk> chunks;
+    int chunkCapacity;
+    int chunkBytes;
+    int size;
+    int numChunkAllocations = 0;
 
-    // Entity tags (one tag name per entity)
-    std::unordered_map<std::string, Entity> entityPerTag;
-    std::unordered_map<int, std::string> tagPerEntity;
+public:
+    Archetype(const Signature &signature, const std::array<ComponentInfo, MAX_COMPONENTS> &componentInfos);
+    ~Archetype();
 
-    // Entity groups (a set of entities per group name)
-    std::unordered_map<std::string, std::set<Entity>> entitiesPerGroup;
-    std::unordered_map<int, std::string> groupPerEntity;
+    // Cached transitions to the archetype with one component added/removed
+    std::array<Archetype *, MAX_COMPONENTS> addEdges;
+    std::array<Archetype *, MAX_COMPONENTS> removeEdges;
 
-    // List of free entity ids that were previously removed
-    std::deque<int> freeIds;
-};
+    const Signature &GetSignature() const
+    {
+        return signature;
+    }
 
-template <typename TComponrnt>
-void System::RequireComponent()
-{
-    const auto componentId = Component<TComponrnt>::GetId();
-    componentSignature.set(componentId);
-}
+    const std::vector<int> &GetComponentIds() const
+    {
+        return componentIds;
+    }
 
-template <typename TComponent, typename... TArgs>
-void Registry::AddComponent(Entity entity, TArgs &&...args)
-{
-    const auto componentId = Component<TComponent>::GetId();
-    const auto entityId = entity.GetId();
+    int GetSize() const
+    {
+        return size;
+    }
 
-    if (componentId >= static_cast<int>(componentPools.size()))
+    int GetNumChunks() const
     {
-        componentPools.resize(componentId + 1, nullptr);
+        return static_cast<int>(chunks.size());
     }
 
-    if (!componentPools[componentId])
+    int GetChunkSize(int chunk) const
     {
-        std::shared_ptr<Pool<TComponent>> newComponentPool(new Pool<TComponent>());
-        componentPools[componentId] = newComponentPool;
+        return chunks[chunk].count;
     }
 
-    std::shared_ptr<Pool<TComponent>> componentPool = std::static_pointer_cast<Pool<TComponent>>(componentPools[componentId]);
+    int GetChunkCapacity() const
+    {
+        return chunkCapacity;
+    }
 
-    TComponent newComponent(std::forward<TArgs>(args)...);
+    int GetChunkBytes() const
+    {
+        return chunkBytes;
+    }
 
-    componentPool->Set(entityId, newComponent);
+    // Number of chunks allocated since the archetype was created (chunks are freed when they empty)
+    int GetNumChunkAllocations() const
+    {
+        return numChunkAllocations;
+    }
 
-    entityComponentSignatures[entityId].set(componentId);
+    int *GetEntityIds(int chunk) const
+    {
+        return reinterpret_cast<int *>(chunks[chunk].memory.get());
+    }
 
-    Logger::Log("Component id = " + std::to_string(componentId) + " was added to entity id " + std::to_string(entityId));
-}
+    template <typename T>
+    T *GetColumn(int chunk, int componentId) const
+    {
+        return reinterpret_cast<T *>(chunks[chunk].memory.get() + columnOffsets[componentId]);
+    }
 
-template <typename TComponent>
-void Registry::RemoveComponent(Entity entity)
-{
-    const auto componentId = Component<TComponent>::GetId();
-    const auto entityId = entity.GetId();
+    void *GetComponent(int row, int componentId) const
+    {
+        const auto &chunk = chunks[row / chunkCapacity];
+        return chunk.memory.get() + columnOffsets[componentId] + (row % chunkCapacity) * componentInfos[componentId].size;
+    }
 
-    // Remove the component from the component list for that entity
-    std::shared_ptr<Pool<TComponent>> componentPool = std::static_pointer_cast<Pool<TComponent>>(componentPools[componentId]);
-    componentPool->Remove(entityId);
+    // Changes are tracked per chunk: a chunk version is the latest version of any row in it
+    std::uint32_t GetChunkVersion(int chunk, int componentId) const
+    {
+        return chunks[chunk].versions[componentId].load(std::memory_order_relaxed);
+    }
 
-    // Set this component signature for that entity to false
-    entityComponentSignatures[entityId].set(componentId, false);
+    void MarkChanged(int row, int componentId, std::uint32_t version) const;
 
-    Logger::Log("Component id = " + std::to_string(componentId) + " was removed from entity id " + std::to_string(entityId));
-}
+    // Carries the change versions of a row moved from another chunk (or archetype) over to its new chunk
+    void MergeVersions(int row, const Archetype &source, int sourceRow) const;
 
-template <typename TComponrnt>
-bool Registry::HasComponent(Entity entity) const
-{
-    const auto componentId = Component<TComponrnt>::GetId();
-    const auto entityId = entity.GetId();
-    return entityComponentSignatures[entityId].test(componentId);
-};
+    // Reserves a row at the end of the archetype, the component slots are left uninitialized
+    int AddRow(int entityId);
 
-template <typename TComponrnt>
-TComponrnt &Registry::GetComponent(Entity entity) const
-{
-    const auto componentId = Component<TComponrnt>::GetId();
-    const auto entityId = entity.GetId();
-    auto componentPool = std::static_pointer_cast<Pool<TComponrnt>>(componentPools[componentId]);
-    return componentPool->Get(entityId);
+    // Fills the (already destroyed) row with the last row and returns the entity id moved into it (-1 if none)
+    int RemoveRow(int row);
+};
+
+class ArchetypeStorage
+{
+private:
+    struct EntityLocation
+    {
+        Archetype *archetype = nullptr;
+        int row = -1;
+    };
+
+    std::array<ComponentInfo, MAX_COMPONENTS> componentInfos;
+    std::unordered_map<Signature, std::unique_ptr<Archetype>> archetypesPerSignature;
+    std::vector<Archetype *> archetypes;
+    std::vector<EntityLocation> entityLocations;
+
+    // Live and peak number of components of each type across all the archetypes
+    std::array<int, MAX_COMPONENTS> componentCounts{};
+    std::array<int, MAX_COMPONENTS> peakComponentCounts{};
+
+    Archetype *GetArchetype(const Signature &signature);
+    void MoveEntity(int entityId, Archetype *destination);
+
+public:
+    ArchetypeStorage() = default;
+    ~ArchetypeStorage() = default;
+
+    template <typename T>
+    void RegisterComponent(int componentId);
+
+    // Constructs a component in place, moving the entity to its new archetype
+    template <typename T, typename... TArgs>
+    void Add(int entityId, int componentId, TArgs &&...args);
+    // Adds several components with a single move to the final archetype
+    template <typename... TComponents>
+    void AddMany(int entityId, const Signature &signature, TComponents &&...components);
+    // Gives new entities (with no components yet) a copy of the prototypes of the signature
+    void AddCopies(const int *entityIds, int count, const Signature &signature, const std::array<const void *, MAX_COMPONENTS> &prototypes, std::uint32_t version);
+    void Remove(int entityId, int componentId);
+    void RemoveEntity(int entityId);
+
+    void MarkChanged(int entityId, int componentId, std::uint32_t version) const
+    {
+        const auto &location = entityLocations[entityId];
+        location.archetype->MarkChanged(location.row, componentId, version);
+    }
+
+    template <typename T>
+    T &Get(int entityId, int componentId) const
+    {
+        return *static_cast<T *>(GetComponentPointer(entityId, componentId));
+    }
+
+    void *GetComponentPointer(int entityId, int componentId) const
+    {
+        const auto &location = entityLocations[entityId];
+        return location.archetype->GetComponent(location.row, componentId);
+    }
+
+    const std::vector<Archetype *> &GetArchetypes() const
+    {
+        return archetypes;
+    }
+
+    bool IsRegistered(int componentId) const
+    {
+        return componentInfos[componentId].relocate != nullptr;
+    }
+
+    // Stats of a registered component, the bytes are its share of the chunks of the archetypes that store it
+    ComponentStats GetStats(int componentId) const;
+};
+
+template <typename T>
+void ArchetypeStorage::RegisterComponent(int componentId)
+{
+    auto &info = componentInfos[componentId];
+    if (info.relocate)
+    {
+        return;
+    }
+    info.size = sizeof(T);
+    info.alignment = alignof(T);
+    info.type = &typeid(T);
+    info.relocate = [](void *destination, void *source)
+    {
+        new (destination) T(std::move(*static_cast<T *>(source)));
+        static_cast<T *>(source)->~T();
+    };
+    info.destroy = [](void *object)
+    {
+        static_cast<T *>(object)->~T();
+    };
+    info.copy = [](void *destination, const void *source)
+    {
+        new (destination) T(*static_cast<const T *>(source));
+    };
+}
+
+template <typename T, typename... TArgs>
+void ArchetypeStorage::Add(int entityId, int componentId, TArgs &&...args)
+{
+    if (entityId >= static_cast<int>(entityLocations.size()))
+    {
+        entityLocations.resize(entityId + 1);
+    }
+
+    Archetype *source = entityLocations[entityId].archetype;
+    if (source && source->GetSignature().test(componentId))
+    {
+        // If the entity already has this component, simply replace the component object
+        Get<T>(entityId, componentId) = T(std::forward<TArgs>(args)...);
+        return;
+    }
+
+    Archetype *destination = source ? source->addEdges[componentId] : nullptr;
+    if (!destination)
+    {
+        Signature signature = source ? source->GetSignature() : Signature();
+        signature.set(componentId);
+        destination = GetArchetype(signature);
+        if (source)
+        {
+            source->addEdges[componentId] = destination;
+        }
+    }
+
+    MoveEntity(entityId, destination);
+    const auto &location = entityLocations[entityId];
+    new (destination->GetComponent(location.row, componentId)) T(std::forward<TArgs>(args)...);
+}
+
+template <typename... TComponents>
+void ArchetypeStorage::AddMany(int entityId, const Signature &signature, TComponents &&...components)
+{
+    if (entityId >= static_cast<int>(entityLocations.size()))
+    {
+        entityLocations.resize(entityId + 1);
+    }
+
+    Archetype *source = entityLocations[entityId].archetype;
+    const Signature previousSignature = source ? source->GetSignature() : Signature();
+    Archetype *destination = GetArchetype(previousSignature | signature);
+    if (destination != source)
+    {
+        MoveEntity(entityId, destination);
+    }
+
+    // Components the entity already had are replaced, the new ones are constructed in their empty slots
+    const int row = entityLocations[entityId].row;
+    auto place = [&](auto &&component)
+    {
+        typedef std::decay_t<decltype(component)> T;
+        const auto componentId = Component<T>::GetId();
+        void *slot = destination->GetComponent(row, componentId);
+        if (previousSignature.test(componentId))
+        {
+            *static_cast<T *>(slot) = std::forward<decltype(component)>(component);
+        }
+        else
+        {
+            new (slot) T(std::forward<decltype(component)>(component));
+        }
+    };
+    (place(std::forward<TComponents>(components)), ...);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// EntityView
+////////////////////////////////////////////////////////////////////////////////
+// A view joins the pools of the requested component types: it walks the
+// smallest pool and hands out references to all components of each entity
+// that has every requested component. Requesting Changed<T> instead of T
+// also skips the entities whose T did not change since the view's version
+// (with archetype storage changes are tracked per chunk, so unchanged
+// entities that share a chunk with a changed one are visited too)
+////////////////////////////////////////////////////////////////////////////////
+template <typename... TComponents>
+class EntityView
+{
+private:
+    class Registry *registry;
+    const std::vector<Signature> &entitySignatures;
+    Signature signature;
+    std::tuple<Pool<typename ComponentOf<TComponents>::type> *...> pools;
+    const std::vector<int> *entityIds;
+    const ArchetypeStorage *archetypes;
+    const EntityGenerations &generations;
+
+    // Only entities whose Changed<T> components have a newer version are visited
+    std::uint32_t sinceVersion;
+
+    template <typename T>
+    bool HasChanged(int entityId) const
+    {
+        if constexpr (ComponentOf<T>::isChangedFilter)
+        {
+            return std::get<Pool<typename ComponentOf<T>::type> *>(pools)->GetVersion(entityId) > sinceVersion;
+        }
+        return true;
+    }
+
+    template <typename T>
+    bool HasChangedInChunk(const Archetype *archetype, int chunk) const
+    {
+        if constexpr (ComponentOf<T>::isChangedFilter)
+        {
+            return archetype->GetChunkVersion(chunk, Component<typename ComponentOf<T>::type>::GetId()) > sinceVersion;
+        }
+        return true;
+    }
+
+    // Walk the chunks of every matching archetype, visiting the entities in the [begin, end) range
+    template <typename TFunc>
+    void EachInArchetypes(int begin, int end, TFunc func) const
+    {
+        int offset = 0;
+        for (auto archetype : archetypes->GetArchetypes())
+        {
+            if ((archetype->GetSignature() & signature) != signature)
+            {
+                continue;
+            }
+            for (int chunk = 0; chunk < archetype->GetNumChunks() && offset < end; chunk++)
+            {
+                const int count = archetype->GetChunkSize(chunk);
+                const int first = std::max(begin - offset, 0);
+                const int last = std::min(end - offset, count);
+                offset += count;
+                if (first >= last || !(HasChangedInChunk<TComponents>(archetype, chunk) && ...))
+                {
+                    continue;
+                }
+                const int *ids = archetype->GetEntityIds(chunk);
+                auto columns = std::make_tuple(archetype->template GetColumn<typename ComponentOf<TComponents>::type>(chunk, Component<typename ComponentOf<TComponents>::type>::GetId())...);
+                for (int row = first; row < last; row++)
+                {
+                    Entity entity(ids[row], generations.GetGeneration(ids[row]));
+                    entity.registry = registry;
+                    func(entity, std::get<typename ComponentOf<TComponents>::type *>(columns)[row]...);
+                }
+            }
+        }
+    }
+
+public:
+    EntityView(class Registry *registry, const std::vector<Signature> &entitySignatures, const EntityGenerations &generations, const Signature &signature, std::uint32_t sinceVersion, const ArchetypeStorage *archetypes, Pool<typename ComponentOf<TComponents>::type> *...pools)
+        : registry(registry), entitySignatures(entitySignatures), signature(signature), pools(pools...), entityIds(nullptr), archetypes(archetypes), generations(generations), sinceVersion(sinceVersion)
+    {
+        // If any of the pools does not exist yet the view is simply empty
+        const bool hasAllPools = ((pools != nullptr) && ...);
+        if (hasAllPools)
+        {
+            // Drive the iteration with the pool that has the fewest elements
+            const std::vector<int> *candidates[] = {&pools->GetEntityIds()...};
+            entityIds = candidates[0];
+            for (auto candidate : candidates)
+            {
+                if (candidate->size() < entityIds->size())
+                {
+                    entityIds = candidate;
+                }
+            }
+        }
+    }
+
+    // Upper bound of entities visited by Each (the size of the smallest pool, or of all matching archetypes)
+    int Size() const
+    {
+        if (archetypes)
+        {
+            int size = 0;
+            for (auto archetype : archetypes->GetArchetypes())
+            {
+                if ((archetype->GetSignature() & signature) == signature)
+                {
+                    size += archetype->GetSize();
+                }
+            }
+            return size;
+        }
+        return entityIds ? static_cast<int>(entityIds->size()) : 0;
+    }
+
+    // Invoke func(Entity, TComponents &...) for every entity in the view
+    template <typename TFunc>
+    void Each(TFunc func) const
+    {
+        Each(0, Size(), func);
+    }
+
+    // Same as above, restricted to the [begin, end) slice of the view
+    template <typename TFunc>
+    void Each(int begin, int end, TFunc func) const
+    {
+        if (archetypes)
+        {
+            EachInArchetypes(begin, end, func);
+            return;
+        }
+        for (int i = begin; i < end; i++)
+        {
+            const int entityId = (*entityIds)[i];
+            if ((entitySignatures[entityId] & signature) != signature || !(HasChanged<TComponents>(entityId) && ...))
+            {
+                continue;
+            }
+            Entity entity(entityId, generations.GetGeneration(entityId));
+            entity.registry = registry;
+            func(entity, std::get<Pool<typename ComponentOf<TComponents>::type> *>(pools)->Get(entityId)...);
+        }
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// CommandBuffer
+////////////////////////////////////////////////////////////////////////////////
+// Records structural changes (create, kill, add and remove components, tags
+// and groups) so they can be requested from any thread. Every thread gets its
+// own buffer from the registry, and the buffers are merged at the beginning of
+// Registry::Update(): first all the creations and then all the other commands,
+// ordered by their sort key, then by their source (the scheduled system that
+// recorded them) and then by the order they were recorded in. The registry only
+// sets the source on the thread that runs the system: jobs that a system starts
+// itself record with whatever source their thread has, so they must copy the
+// system's source (GetSource/SetSource) and use different sort keys for the
+// merge to be reproducible
+////////////////////////////////////////////////////////////////////////////////
+
+// Entity created through a command buffer, it only gets a real id when the buffer is merged
+struct DeferredEntity
+{
+    int index;
+};
+
+class CommandBuffer
+{
+public:
+    // Commands recorded from now on are ordered by this key when merged (use something
+    // stable like the id of the entity that triggered them for a deterministic result)
+    void SetSortKey(int key)
+    {
+        sortKey = key;
+    }
+
+    // Save it before changing the key and restore it afterwards, so later commands of the thread keep their key
+    int GetSortKey() const
+    {
+        return sortKey;
+    }
+
+    // Commands recorded from now on are ordered by this source among the commands with the same
+    // sort key (set by the registry to the schedule position of the system that is running)
+    void SetSource(int newSource)
+    {
+        source = newSource;
+    }
+
+    int GetSource() const
+    {
+        return source;
+    }
+
+    DeferredEntity CreateEntity();
+    // Deferred Registry::Instantiate of a single entity
+    DeferredEntity Instantiate(PrefabId prefab);
+
+    template <typename TEntity>
+    void KillEntity(TEntity entity);
+    template <typename TComponent, typename TEntity, typename... TArgs>
+    void AddComponent(TEntity entity, TArgs &&...args);
+    template <typename TEntity, typename... TComponents>
+    void AddComponents(TEntity entity, TComponents &&...components);
+    template <typename TComponent, typename TEntity>
+    void RemoveComponent(TEntity entity);
+    template <typename TEntity>
+    void TagEntity(TEntity entity, TagId tag);
+    template <typename TEntity>
+    void GroupEntity(TEntity entity, GroupId group);
+
+    bool IsEmpty() const
+    {
+        return commands.empty();
+    }
+
+private:
+    friend class Registry;
+
+    struct Command
+    {
+        int sortKey;
+        int source;
+        // Either an existing entity (skipped if it is no longer valid) or the index of a deferred entity
+        Entity target;
+        int deferredIndex;
+        // Empty for the creation of a deferred entity
+        std::function<void(class Registry &, Entity)> apply;
+        // Prefab the deferred entity is instantiated from (-1 for an empty entity)
+        PrefabId prefab = -1;
+    };
+
+    std::vector<Command> commands;
+    int numDeferredEntities = 0;
+
+    template <typename TEntity>
+    void PushCommand(TEntity entity, std::function<void(class Registry &, Entity)> apply)
+    {
+        const auto target = GetTarget(entity);
+        commands.push_back({sortKey, source, target.first, target.second, std::move(apply)});
+    }
+    int sortKey = 0;
+    int source = 0;
+
+    static std::pair<Entity, int> GetTarget(Entity entity)
+    {
+        return {entity, -1};
+    }
+    static std::pair<Entity, int> GetTarget(DeferredEntity entity)
+    {
+        return {Entity(-1), entity.index};
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// OwningGroup
+////////////////////////////////////////////////////////////////////////////////
+// An owning group takes over the pools of its component types and keeps the
+// entities that have all of them packed at the front of every pool, in the
+// same order. Iterating the group walks all the pools in lockstep without
+// any lookup. A pool can only be owned by one group. With archetype storage
+// (already packed per chunk) or when a pool is owned by another group, the
+// group falls back to a regular view
+////////////////////////////////////////////////////////////////////////////////
+template <typename... TComponents>
+class OwningGroup
+{
+private:
+    class Registry *registry;
+    const EntityGenerations &generations;
+    std::tuple<Pool<TComponents> *...> pools;
+    // Number of packed entities, owned by the registry (null when falling back to the view)
+    const int *size;
+    EntityView<TComponents...> view;
+
+public:
+    OwningGroup(class Registry *registry, const EntityGenerations &generations, const int *size, EntityView<TComponents...> view, Pool<TComponents> *...pools)
+        : registry(registry), generations(generations), pools(pools...), size(size), view(view)
+    {
+    }
+
+    int Size() const
+    {
+        return size ? *size : view.Size();
+    }
+
+    // Invoke func(Entity, TComponents &...) for every entity in the group
+    template <typename TFunc>
+    void Each(TFunc func) const
+    {
+        Each(0, Size(), func);
+    }
+
+    // Same as above, restricted to the [begin, end) slice of the group
+    template <typename TFunc>
+    void Each(int begin, int end, TFunc func) const
+    {
+        if (!size)
+        {
+            view.Each(begin, end, func);
+            return;
+        }
+        const auto firstPool = std::get<0>(pools);
+        for (int i = begin; i < end; i++)
+        {
+            const int entityId = firstPool->GetEntityId(i);
+            Entity entity(entityId, generations.GetGeneration(entityId));
+            entity.registry = registry;
+            func(entity, (*std::get<Pool<TComponents> *>(pools))[i]...);
+        }
+    }
+};
+
+class Registry
+{
+public:
+    Registry(StorageMode storageMode = StorageMode::Pools)
+    {
+        if (storageMode == StorageMode::Archetypes)
+        {
+            archetypes = std::make_unique<ArchetypeStorage>();
+        }
+        Logger::Log("Registry created");
+    };
+    ~Registry()
+    {
+        Logger::Log("Registry destroyed");
+    };
+
+    // Once MAX_ENTITIES entities are alive, CreateEntity returns an invalid entity (id -1, check it
+    // with Valid/IsValid) and CreateEntities returns fewer entities than requested
+    Entity CreateEntity();
+    std::vector<Entity> CreateEntities(int count);
+    // Killing an entity that is no longer valid does nothing
+    void KillEntity(Entity entity);
+
+    // O(1) liveness checks, safe to call from any thread
+    bool Valid(EntityHandle handle) const
+    {
+        return entityGenerations.IsAlive(handle & ENTITY_INDEX_MASK, handle >> ENTITY_INDEX_BITS);
+    }
+    bool Valid(Entity entity) const
+    {
+        return entityGenerations.IsAlive(entity.GetId(), entity.GetGeneration());
+    }
+    // Entity of a handle, or an entity with id -1 if the handle is stale
+    Entity GetEntity(EntityHandle handle);
+
+    StorageMode GetStorageMode() const
+    {
+        return archetypes ? StorageMode::Archetypes : StorageMode::Pools;
+    }
+
+    // Tag and group name interning (the same name always maps to the same id). The names are
+    // shared by all the registries and can be used from any thread
+    static TagId GetTagId(const std::string &tag);
+    static GroupId GetGroupId(const std::string &group);
+    // Id of a name that was already interned, or -1 (queries use these so they never add names)
+    static TagId FindTagId(const std::string &tag);
+    static GroupId FindGroupId(const std::string &group);
+
+    // Tag management
+    void TagEntity(Entity entity, TagId tag);
+    void TagEntity(Entity entity, const std::string &tag);
+    bool EntityHasTag(Entity entity, TagId tag) const;
+    bool EntityHasTag(Entity entity, const std::string &tag) const;
+    // Entity with the tag, or an entity with id -1 (which is never valid) if no entity has it
+    Entity GetEntityByTag(TagId tag) const;
+    Entity GetEntityByTag(const std::string &tag) const;
+    void RemoveEntityTag(Entity entity);
+
+    // Group management
+    void GroupEntity(Entity entity, GroupId group);
+    void GroupEntity(Entity entity, const std::string &group);
+    bool EntityBelongsToGroup(Entity entity, GroupId group) const;
+    bool EntityBelongsToGroup(Entity entity, const std::string &group) const;
+    std::vector<Entity> GetEntitiesByGroup(GroupId group) const;
+    std::vector<Entity> GetEntitiesByGroup(const std::string &group) const;
+    void RemoveEntityGroup(Entity entity);
+
+    void Update();
+    void AddEntityToSystem(Entity entity, System *system);
+
+    // Buffer of deferred structural changes for the calling thread (safe to call from any thread)
+    CommandBuffer &GetCommandBuffer();
+    // Apply and clear all the command buffers (done by Update, only call it from the main thread)
+    void FlushCommandBuffers();
+    void RemoveEntityFromSystem(Entity entity, System *system);
+
+    template <typename TComponrnt, typename... TArgs>
+    void AddComponent(Entity entity, TArgs &&...args);
+    // Adds several already constructed components at once (moved into place, no logging)
+    template <typename... TComponents>
+    void AddComponents(Entity entity, TComponents &&...components);
+    template <typename TComponrnt>
+    void RemoveComponent(Entity entity);
+    template <typename TComponrnt>
+    bool HasComponent(Entity entity) const;
+    template <typename TComponrnt>
+    TComponrnt &GetComponent(Entity entity) const;
+
+    // Prefabs: the components (and groups) added to a prefab are copied to every instance, so
+    // instantiating costs a copy per component instead of constructing and adding them one by one
+    PrefabId CreatePrefab();
+    template <typename TComponent, typename... TArgs>
+    void AddPrefabComponent(PrefabId prefab, TArgs &&...args);
+    template <typename TComponent>
+    TComponent &GetPrefabComponent(PrefabId prefab) const;
+    void GroupPrefab(PrefabId prefab, GroupId group);
+    void GroupPrefab(PrefabId prefab, const std::string &group);
+    // Creates count entities with a copy of all the components of the prefab (fewer if the entity limit is reached)
+    std::vector<Entity> Instantiate(PrefabId prefab, int count = 1);
+
+    // Change tracking: components get the current change version when they are added or marked as
+    // changed (writing through GetComponent is not tracked, call MarkChanged after it). A system
+    // remembers the version returned by AdvanceChangeVersion() on every run and asks for
+    // Changed<T> since that version on the next run
+    template <typename TComponent>
+    void MarkChanged(Entity entity);
+    std::uint32_t GetChangeVersion() const
+    {
+        return changeVersion.load(std::memory_order_relaxed);
+    }
+    // Returns the current version and starts a new one (changes marked from now on are newer)
+    std::uint32_t AdvanceChangeVersion()
+    {
+        return changeVersion.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Component observers: Callback is a member function of the owner taking (Entity, TComponent &),
+    // e.g. OnComponentAdded<HealthComponent, &MySystem::OnHealthAdded>(this). Added hooks run after
+    // the component is constructed, removed hooks (also on kill) run before it is destroyed and
+    // changed hooks run when a component is replaced or marked as changed
+    template <typename TComponent, auto Callback, typename TOwner>
+    void OnComponentAdded(TOwner *owner);
+    template <typename TComponent, auto Callback, typename TOwner>
+    void OnComponentRemoved(TOwner *owner);
+    template <typename TComponent, auto Callback, typename TOwner>
+    void OnComponentChanged(TOwner *owner);
+    // Remove all the hooks registered by an owner
+    void RemoveObservers(const void *owner);
+
+    // Instrumentation: memory and occupancy of every component storage (prefab pools excluded),
+    // the number of entities of every system, and a text dump of both
+    std::vector<ComponentStats> GetComponentStats() const;
+    std::vector<SystemStats> GetSystemStats() const;
+    bool DumpStats(const std::string &filePath) const;
+
+    template <typename TSystem, typename... TArgs>
+    void AddSystem(TArgs &&...args);
+    template <typename TSystem>
+    void RemoveSystem();
+    template <typename TSystem>
+    bool HasSystem() const;
+    template <typename TSystem>
+    TSystem &GetSystem() const;
+
+    // Multi-component iteration over the packed pools (Changed<T> filters use sinceVersion)
+    template <typename... TComponents>
+    EntityView<TComponents...> View(std::uint32_t sinceVersion = 0);
+
+    // Owning group of the components (created the first time it is requested)
+    template <typename... TComponents>
+    OwningGroup<TComponents...> Group();
+    template <typename... TComponents, typename TFunc>
+    void Each(TFunc func);
+
+    void AddEntityToSystems(Entity entity);
+    void RemoveEntityFromSystems(Entity entity);
+
+    // System scheduling: systems are run in the order they were scheduled, but
+    // consecutive systems with no conflicting access run concurrently
+    template <typename TSystem>
+    void ScheduleSystem(std::function<void()> update);
+    void RunScheduledSystems(JobSystem &jobSystem);
+
+private:
+    struct ScheduledSystem
+    {
+        System *system;
+        std::function<void()> update;
+    };
+    std::vector<ScheduledSystem> schedule;
+
+    // Groups of scheduled systems that can run at the same time (rebuilt when the schedule changes)
+    std::vector<std::vector<int>> scheduleStages;
+
+    void BuildScheduleStages();
+    void RunScheduledSystem(int index);
+    void UnscheduleSystem(System *system);
+
+    // Observer hooks: the owner and a typed trampoline that calls its member function
+    struct ComponentObserver
+    {
+        void *owner;
+        void (*invoke)(void *owner, Entity entity, void *component);
+    };
+    enum ObserverHook
+    {
+        HOOK_ADDED,
+        HOOK_REMOVED,
+        HOOK_CHANGED,
+        NUM_OBSERVER_HOOKS
+    };
+    std::array<std::array<std::vector<ComponentObserver>, MAX_COMPONENTS>, NUM_OBSERVER_HOOKS> componentObservers;
+    // Components with at least one hook of each kind, so unobserved components only cost a bit test
+    std::array<Signature, NUM_OBSERVER_HOOKS> observedComponents;
+
+    template <typename TComponent, auto Callback, typename TOwner>
+    static void InvokeObserver(void *owner, Entity entity, void *component)
+    {
+        (static_cast<TOwner *>(owner)->*Callback)(entity, *static_cast<TComponent *>(component));
+    }
+    template <typename TComponent, auto Callback, typename TOwner>
+    void AddObserver(ObserverHook hook, TOwner *owner);
+    void NotifyObservers(ObserverHook hook, Entity entity, int componentId);
+    void *GetComponentPointer(int entityId, int componentId) const;
+
+    // Owning groups, stored by pointer so the groups can keep a pointer to their size
+    struct OwningGroupData
+    {
+        Signature signature;
+        std::vector<int> componentIds;
+        int size = 0;
+    };
+    std::vector<std::unique_ptr<OwningGroupData>> owningGroups;
+    // Components whose pools are owned by a group
+    Signature ownedComponents;
+
+    // Prefab components live in pools of their own, indexed by prefab id
+    struct PrefabData
+    {
+        Signature signature;
+        GroupMask groups;
+    };
+    std::vector<PrefabData> prefabs;
+    std::array<std::unique_ptr<IPool>, MAX_COMPONENTS> prefabPools;
+
+    bool IsInOwningGroup(const OwningGroupData &group, int entityId) const;
+    void AddToOwningGroups(int entityId, const Signature &addedSignature);
+    void RemoveFromOwningGroups(int entityId, const Signature &removedSignature);
+
+    template <typename TComponent>
+    Pool<TComponent> *GetPool() const;
+    template <typename TComponent>
+    Pool<TComponent> *GetOrCreatePool();
+    template <typename... TComponents>
+    static Signature GetSignature();
+    template <typename TComponent, typename... TArgs>
+    void EmplaceComponent(int entityId, TArgs &&...args);
+    int NextEntityId();
+    // Whether the id of the entity indexes the per-entity tag and group tables
+    bool HasEntitySlot(Entity entity) const
+    {
+        return entity.GetId() >= 0 && entity.GetId() < static_cast<int>(tagPerEntity.size());
+    }
+
+    int numEntities = 0;
+    EntityGenerations entityGenerations;
+    std::atomic<std::uint32_t> changeVersion{1};
+    std::array<std::unique_ptr<IPool>, MAX_COMPONENTS> componentPools;
+
+    // Only used when the registry was created with StorageMode::Archetypes
+    std::unique_ptr<ArchetypeStorage> archetypes;
+    std::vector<Signature> entityComponentSignatures;
+    std::unordered_map<std::type_index, std::shared_ptr<System>> systems;
+
+    // Cache of the systems interested in each entity signature (invalidated when systems are added or removed)
+    std::unordered_map<Signature, std::vector<System *>> systemsPerSignature;
+
+    // Signature each entity had when it was added to the systems, used to find them again on removal
+    std::vector<Signature> entitySystemSignatures;
+
+    const std::vector<System *> &GetSystemsForSignature(const Signature &signature);
+
+    // Structural changes recorded during the frame, applied in batches by Update()
+    std::vector<Entity> entitiesToBeAdded;
+    std::vector<Entity> entitiesToBeKilled;
+
+    // Entity tags (one tag per entity, -1 means untagged)
+    std::vector<Entity> entityPerTag;
+    std::vector<TagId> tagPerEntity;
+
+    // Entity groups (a bitmask of groups per entity, indexed like the signatures)
+    std::vector<GroupMask> entityGroups;
+
+    // List of free entity ids that were previously removed
+    std::deque<int> freeIds;
+
+    // One command buffer per thread that recorded structural changes
+    std::vector<std::pair<std::thread::id, std::unique_ptr<CommandBuffer>>> commandBuffers;
+    std::mutex commandBuffersMutex;
+};
+
+template <typename TEntity>
+void CommandBuffer::KillEntity(TEntity entity)
+{
+    PushCommand(entity, [](Registry &registry, Entity entity)
+                { registry.KillEntity(entity); });
+}
+
+template <typename TComponent, typename TEntity, typename... TArgs>
+void CommandBuffer::AddComponent(TEntity entity, TArgs &&...args)
+{
+    PushCommand(entity, [component = TComponent(std::forward<TArgs>(args)...)](Registry &registry, Entity entity) mutable
+                { registry.AddComponents(entity, std::move(component)); });
+}
+
+template <typename TEntity, typename... TComponents>
+void CommandBuffer::AddComponents(TEntity entity, TComponents &&...components)
+{
+    PushCommand(entity, [components = std::make_tuple(std::forward<TComponents>(components)...)](Registry &registry, Entity entity) mutable
+                { std::apply([&registry, entity](auto &...components)
+                             { registry.AddComponents(entity, std::move(components)...); },
+                             components); });
+}
+
+template <typename TComponent, typename TEntity>
+void CommandBuffer::RemoveComponent(TEntity entity)
+{
+    PushCommand(entity, [](Registry &registry, Entity entity)
+                { registry.RemoveComponent<TComponent>(entity); });
+}
+
+template <typename TEntity>
+void CommandBuffer::TagEntity(TEntity entity, TagId tag)
+{
+    PushCommand(entity, [tag](Registry &registry, Entity entity)
+                { registry.TagEntity(entity, tag); });
+}
+
+template <typename TEntity>
+void CommandBuffer::GroupEntity(TEntity entity, GroupId group)
+{
+    PushCommand(entity, [group](Registry &registry, Entity entity)
+                { registry.GroupEntity(entity, group); });
+}
+
+template <typename TComponrnt>
+void System::RequireComponent()
+{
+    const auto componentId = Component<TComponrnt>::GetId();
+    componentSignature.set(componentId);
+    componentReads.set(componentId);
+}
+
+template <typename TComponent>
+void System::ReadsComponent()
+{
+    componentReads.set(Component<TComponent>::GetId());
+}
+
+template <typename TComponent>
+void System::WritesComponent()
+{
+    componentReads.set(Component<TComponent>::GetId());
+    componentWrites.set(Component<TComponent>::GetId());
+}
+
+template <typename TComponent, typename... TArgs>
+void Registry::EmplaceComponent(int entityId, TArgs &&...args)
+{
+    const auto componentId = Component<TComponent>::GetId();
+    if (archetypes)
+    {
+        archetypes->RegisterComponent<TComponent>(componentId);
+        archetypes->Add<TComponent>(entityId, componentId, std::forward<TArgs>(args)...);
+        archetypes->MarkChanged(entityId, componentId, GetChangeVersion());
+    }
+    else
+    {
+        auto pool = GetOrCreatePool<TComponent>();
+        pool->Emplace(entityId, std::forward<TArgs>(args)...);
+        pool->MarkChanged(entityId, GetChangeVersion());
+    }
+}
+
+template <typename TComponent, typename... TArgs>
+void Registry::AddComponent(Entity entity, TArgs &&...args)
+{
+    const auto componentId = Component<TComponent>::GetId();
+    const auto entityId = entity.GetId();
+
+    const bool isReplaced = entityComponentSignatures[entityId].test(componentId);
+    EmplaceComponent<TComponent>(entityId, std::forward<TArgs>(args)...);
+
+    entityComponentSignatures[entityId].set(componentId);
+    if (ownedComponents.test(componentId) && !isReplaced)
+    {
+        AddToOwningGroups(entityId, GetSignature<TComponent>());
+    }
+
+    Logger::Log("Component id = " + std::to_string(componentId) + " was added to entity id " + std::to_string(entityId));
+
+    const auto hook = isReplaced ? HOOK_CHANGED : HOOK_ADDED;
+    if (observedComponents[hook].test(componentId))
+    {
+        NotifyObservers(hook, entity, componentId);
+    }
+}
+
+template <typename... TComponents>
+void Registry::AddComponents(Entity entity, TComponents &&...components)
+{
+    const auto entityId = entity.GetId();
+    const auto signature = GetSignature<std::decay_t<TComponents>...>();
+    const auto previousSignature = entityComponentSignatures[entityId];
+
+    if (archetypes)
+    {
+        (archetypes->RegisterComponent<std::decay_t<TComponents>>(Component<std::decay_t<TComponents>>::GetId()), ...);
+        archetypes->AddMany(entityId, signature, std::forward<TComponents>(components)...);
+        (archetypes->MarkChanged(entityId, Component<std::decay_t<TComponents>>::GetId(), GetChangeVersion()), ...);
+    }
+    else
+    {
+        (EmplaceComponent<std::decay_t<TComponents>>(entityId, std::forward<TComponents>(components)), ...);
+    }
+
+    entityComponentSignatures[entityId] |= signature;
+    if ((ownedComponents & signature & ~previousSignature).any())
+    {
+        AddToOwningGroups(entityId, signature & ~previousSignature);
+    }
+
+    if (((observedComponents[HOOK_ADDED] | observedComponents[HOOK_CHANGED]) & signature).any())
+    {
+        for (auto componentId : {Component<std::decay_t<TComponents>>::GetId()...})
+        {
+            const auto hook = previousSignature.test(componentId) ? HOOK_CHANGED : HOOK_ADDED;
+            if (observedComponents[hook].test(componentId))
+            {
+                NotifyObservers(hook, entity, componentId);
+            }
+        }
+    }
+}
+
+template <typename TComponent, typename... TArgs>
+void Registry::AddPrefabComponent(PrefabId prefab, TArgs &&...args)
+{
+    const auto componentId = Component<TComponent>::GetId();
+    auto &pool = prefabPools[componentId];
+    if (!pool)
+    {
+        pool = std::make_unique<Pool<TComponent>>(8);
+    }
+    static_cast<Pool<TComponent> *>(pool.get())->Emplace(prefab, std::forward<TArgs>(args)...);
+    prefabs[prefab].signature.set(componentId);
+
+    // Instances are copied straight into the storage, so it has to know the component type beforehand
+    if (archetypes)
+    {
+        archetypes->RegisterComponent<TComponent>(componentId);
+    }
+    else
+    {
+        GetOrCreatePool<TComponent>();
+    }
+}
+
+template <typename TComponent>
+TComponent &Registry::GetPrefabComponent(PrefabId prefab) const
+{
+    return static_cast<Pool<TComponent> *>(prefabPools[Component<TComponent>::GetId()].get())->Get(prefab);
+}
+
+template <typename TComponent>
+void Registry::RemoveComponent(Entity entity)
+{
+    const auto componentId = Component<TComponent>::GetId();
+    const auto entityId = entity.GetId();
+
+    // Nothing to remove (the pool may not even have a page for the entity)
+    if (!entityComponentSignatures[entityId].test(componentId))
+    {
+        return;
+    }
+
+    if (observedComponents[HOOK_REMOVED].test(componentId))
+    {
+        NotifyObservers(HOOK_REMOVED, entity, componentId);
+    }
+    if (ownedComponents.test(componentId))
+    {
+        RemoveFromOwningGroups(entityId, GetSignature<TComponent>());
+    }
+
+    // Remove the component from the component list for that entity
+    if (archetypes)
+    {
+        archetypes->Remove(entityId, componentId);
+    }
+    else
+    {
+        GetPool<TComponent>()->Remove(entityId);
+    }
+
+    // Set this component signature for that entity to false
+    entityComponentSignatures[entityId].set(componentId, false);
+
+    Logger::Log("Component id = " + std::to_string(componentId) + " was removed from entity id " + std::to_string(entityId));
+}
+
+template <typename TComponrnt>
+bool Registry::HasComponent(Entity entity) const
+{
+    const auto componentId = Component<TComponrnt>::GetId();
+    const auto entityId = entity.GetId();
+    return entityComponentSignatures[entityId].test(componentId);
+};
+
+template <typename TComponrnt>
+TComponrnt &Registry::GetComponent(Entity entity) const
+{
+    const auto componentId = Component<TComponrnt>::GetId();
+    const auto entityId = entity.GetId();
+    if (archetypes)
+    {
+        return archetypes->Get<TComponrnt>(entityId, componentId);
+    }
+    return GetPool<TComponrnt>()->Get(entityId);
 };
 
 template <typename TSystem, typename... TArgs>
@@ -373,13 +1712,17 @@ void Registry::AddSystem(TArgs &&...args)
 {
     std::shared_ptr<TSystem> newSystem = std::make_shared<TSystem>(std::forward<TArgs>(args)...);
     systems.insert(std::make_pair(std::type_index(typeid(TSystem)), newSystem));
+    systemsPerSignature.clear();
 };
 
 template <typename TSystem>
 void Registry::RemoveSystem()
 {
     const auto systemId = systems.find(std::type_index(typeid(TSystem)));
+    UnscheduleSystem(systemId->second.get());
+    RemoveObservers(static_cast<TSystem *>(systemId->second.get()));
     systems.erase(systemId);
+    systemsPerSignature.clear();
 };
 
 template <typename TSystem>
@@ -396,18 +1739,165 @@ TSystem &Registry::GetSystem() const
     return *(std::static_pointer_cast<TSystem>(systemId->second));
 };
 
+template <typename TSystem>
+void Registry::ScheduleSystem(std::function<void()> update)
+{
+    schedule.push_back({&GetSystem<TSystem>(), std::move(update)});
+    scheduleStages.clear();
+}
+
+template <typename TComponent>
+Pool<TComponent> *Registry::GetPool() const
+{
+    return static_cast<Pool<TComponent> *>(componentPools[Component<TComponent>::GetId()].get());
+}
+
+template <typename TComponent>
+Pool<TComponent> *Registry::GetOrCreatePool()
+{
+    auto &pool = componentPools[Component<TComponent>::GetId()];
+    if (!pool)
+    {
+        pool = std::make_unique<Pool<TComponent>>();
+    }
+    return static_cast<Pool<TComponent> *>(pool.get());
+}
+
+template <typename... TComponents>
+Signature Registry::GetSignature()
+{
+    Signature signature;
+    (signature.set(Component<TComponents>::GetId()), ...);
+    return signature;
+}
+
+template <typename... TComponents>
+EntityView<TComponents...> Registry::View(std::uint32_t sinceVersion)
+{
+    return EntityView<TComponents...>(this, entityComponentSignatures, entityGenerations, GetSignature<typename ComponentOf<TComponents>::type...>(), sinceVersion, archetypes.get(), GetPool<typename ComponentOf<TComponents>::type>()...);
+}
+
+template <typename... TComponents>
+OwningGroup<TComponents...> Registry::Group()
+{
+    const auto signature = GetSignature<TComponents...>();
+    const int *size = nullptr;
+    if (!archetypes)
+    {
+        OwningGroupData *group = nullptr;
+        for (auto &owningGroup : owningGroups)
+        {
+            if (owningGroup->signature == signature)
+            {
+                group = owningGroup.get();
+            }
+        }
+
+        if (!group && (ownedComponents & signature).any())
+        {
+            Logger::Err("Owning group overlaps the pools of another group, using a view instead");
+        }
+        else if (!group)
+        {
+            // Take over the pools (creating the missing ones) and pack the entities that already qualify
+            (GetOrCreatePool<TComponents>(), ...);
+            owningGroups.push_back(std::make_unique<OwningGroupData>());
+            group = owningGroups.back().get();
+            group->signature = signature;
+            group->componentIds = {Component<TComponents>::GetId()...};
+            ownedComponents |= signature;
+
+            // Copy the ids of the first pool since packing reorders it
+            const auto entityIds = std::get<0>(std::make_tuple(GetPool<TComponents>()...))->GetEntityIds();
+            for (auto entityId : entityIds)
+            {
+                AddToOwningGroups(entityId, signature);
+            }
+        }
+
+        if (group)
+        {
+            size = &group->size;
+        }
+    }
+    return OwningGroup<TComponents...>(this, entityGenerations, size, View<TComponents...>(), GetPool<TComponents>()...);
+}
+
+template <typename TComponent>
+void Registry::MarkChanged(Entity entity)
+{
+    const auto componentId = Component<TComponent>::GetId();
+    if (archetypes)
+    {
+        archetypes->MarkChanged(entity.GetId(), componentId, GetChangeVersion());
+    }
+    else
+    {
+        GetPool<TComponent>()->MarkChanged(entity.GetId(), GetChangeVersion());
+    }
+
+    if (observedComponents[HOOK_CHANGED].test(componentId))
+    {
+        NotifyObservers(HOOK_CHANGED, entity, componentId);
+    }
+}
+
+template <typename TComponent, auto Callback, typename TOwner>
+void Registry::AddObserver(ObserverHook hook, TOwner *owner)
+{
+    const auto componentId = Component<TComponent>::GetId();
+    componentObservers[hook][componentId].push_back({owner, &Registry::InvokeObserver<TComponent, Callback, TOwner>});
+    observedComponents[hook].set(componentId);
+}
+
+template <typename TComponent, auto Callback, typename TOwner>
+void Registry::OnComponentAdded(TOwner *owner)
+{
+    AddObserver<TComponent, Callback>(HOOK_ADDED, owner);
+}
+
+template <typename TComponent, auto Callback, typename TOwner>
+void Registry::OnComponentRemoved(TOwner *owner)
+{
+    AddObserver<TComponent, Callback>(HOOK_REMOVED, owner);
+}
+
+template <typename TComponent, auto Callback, typename TOwner>
+void Registry::OnComponentChanged(TOwner *owner)
+{
+    AddObserver<TComponent, Callback>(HOOK_CHANGED, owner);
+}
+
+template <typename... TComponents, typename TFunc>
+void Registry::Each(TFunc func)
+{
+    View<TComponents...>().Each(func);
+}
+
 template <typename TComponrnt, typename... TArgs>
 void Entity::AddComponent(TArgs &&...args)
 {
     registry->AddComponent<TComponrnt>(*this, std::forward<TArgs>(args)...);
 };
 
+template <typename... TComponents>
+void Entity::AddComponents(TComponents &&...components)
+{
+    registry->AddComponents(*this, std::forward<TComponents>(components)...);
+};
+
 template <typename TComponrnt>
 void Entity::RemoveComponent()
 {
     registry->RemoveComponent<TComponrnt>(*this);
 };
 
+template <typename TComponent>
+void Entity::MarkChanged() const
+{
+    registry->MarkChanged<TComponent>(*this);
+}
+
 template <typename TComponrnt>
 bool Entity::HasComponent() const
 {
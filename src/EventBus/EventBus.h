@@ -3,55 +3,293 @@
 
 #include "../Logger/Logger.h"
 #include "Event.h"
-#include <map>
-#include <typeindex>
-#include <functional>
-#include <list>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <iterator>
 
-class IEventCallback
+///////////////////////////////////////////////////////////////////////
+// Every event type gets a small dense id the first time it is used, so
+// the bus can keep its handlers in an array indexed by event type
+///////////////////////////////////////////////////////////////////////
+class EventTypeCounter
+{
+protected:
+    static int NextId()
+    {
+        static std::atomic<int> nextId{0};
+        return nextId.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+template <typename TEvent>
+class EventType : public EventTypeCounter
+{
+public:
+    static int GetId()
+    {
+        static const int id = NextId();
+        return id;
+    }
+};
+
+// Upper bound of event types that can be queued (see EventBus::QueueEvent)
+const int MAX_EVENT_TYPES = 64;
+
+// Contiguous range of queued events handed to batch handlers
+template <typename TEvent>
+class EventSpan
 {
 private:
-    virtual void Call(Event &e) = 0;
+    TEvent *first;
+    size_t count;
 
 public:
-    virtual ~IEventCallback() = default;
+    EventSpan(TEvent *first, size_t count) : first(first), count(count)
+    {
+    }
+
+    TEvent *begin() const
+    {
+        return first;
+    }
+
+    TEvent *end() const
+    {
+        return first + count;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
 
-    void Execute(Event &e)
+    TEvent &operator[](size_t index) const
     {
-        Call(e);
+        return first[index];
     }
 };
 
+// Event and owner types of a handler member function, either void TOwner::Handler(TEvent &)
+// or a batch handler void TOwner::Handler(EventSpan<TEvent>)
+template <typename TCallback>
+struct EventCallbackTraits;
+
 template <typename TOwner, typename TEvent>
-class EventCallback : public IEventCallback
+struct EventCallbackTraits<void (TOwner::*)(TEvent &)>
+{
+    typedef TOwner owner;
+    typedef TEvent event;
+    static constexpr bool isBatch = false;
+};
+
+template <typename TOwner, typename TEvent>
+struct EventCallbackTraits<void (TOwner::*)(EventSpan<TEvent>)>
+{
+    typedef TOwner owner;
+    typedef TEvent event;
+    static constexpr bool isBatch = true;
+};
+
+// A subscriber is its owner plus a typed trampoline that calls the handler directly
+struct EventHandler
+{
+    void *owner;
+    void (*invoke)(void *owner, Event &event);
+    // Id of the subscription that added this handler
+    unsigned int id;
+};
+
+struct EventBatchHandler
+{
+    void *owner;
+    void (*invoke)(void *owner, void *events, size_t count);
+    unsigned int id;
+};
+
+// Identifies one subscription so it can be removed from the bus (id 0 is never used)
+struct EventSubscription
+{
+    int eventType = -1;
+    unsigned int id = 0;
+};
+
+class EventBus;
+
+// Position of a queued event in the deterministic order (before the order it was queued in)
+struct EventOrder
+{
+    int sortKey;
+    int producer;
+
+    bool operator<(const EventOrder &other) const
+    {
+        return sortKey != other.sortKey ? sortKey < other.sortKey : producer < other.producer;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////
+// Events of one type queued for batch delivery. The channel is a
+// multi-producer, single-consumer queue: every emitting thread appends
+// to a buffer of its own (found in a lock-free list, so queueing never
+// takes a lock), and the consumer merges all the buffers when the
+// events are delivered. Delivery is a sync point: no other thread may
+// queue events while it runs
+///////////////////////////////////////////////////////////////////////
+class IEventChannel
+{
+public:
+    virtual ~IEventChannel() = default;
+    virtual void Deliver(EventBus &eventBus, bool sortByKey) = 0;
+};
+
+template <typename TEvent>
+class EventChannel : public IEventChannel
 {
 private:
-    typedef void (TOwner::*CallbackFunction)(TEvent &);
+    struct ThreadBuffer
+    {
+        std::thread::id thread;
+        std::vector<TEvent> events;
+        std::vector<EventOrder> orders;
+        ThreadBuffer *next;
+    };
+
+    // Buffers are only added (at the front) and live as long as the channel
+    std::atomic<ThreadBuffer *> buffers{nullptr};
 
-    TOwner *ownerInstance;
-    CallbackFunction callbackFunction;
+    // Events being delivered, merged from the thread buffers so handlers can queue new events meanwhile
+    std::vector<TEvent> delivering;
+    std::vector<EventOrder> deliveringOrders;
+    std::vector<int> order;
 
-    virtual void Call(Event &e) override
+    ThreadBuffer *GetThreadBuffer()
     {
-        std::invoke(callbackFunction, ownerInstance, static_cast<TEvent &>(e));
+        const auto thread = std::this_thread::get_id();
+        ThreadBuffer *head = buffers.load(std::memory_order_acquire);
+        for (auto buffer = head; buffer; buffer = buffer->next)
+        {
+            if (buffer->thread == thread)
+            {
+                return buffer;
+            }
+        }
+        // Only the calling thread can add its own buffer, so it is enough to push it
+        auto buffer = new ThreadBuffer{thread, {}, {}, head};
+        while (!buffers.compare_exchange_weak(buffer->next, buffer, std::memory_order_release, std::memory_order_acquire))
+        {
+        }
+        return buffer;
     }
 
 public:
-    EventCallback(TOwner *ownerInstance, CallbackFunction callbackFunction)
+    ~EventChannel() override
     {
-        this->ownerInstance = ownerInstance;
-        this->callbackFunction = callbackFunction;
+        for (auto buffer = buffers.load(); buffer;)
+        {
+            auto next = buffer->next;
+            delete buffer;
+            buffer = next;
+        }
     }
 
-    virtual ~EventCallback() override = default;
-};
+    template <typename... TArgs>
+    void Push(EventOrder eventOrder, TArgs &&...args)
+    {
+        auto buffer = GetThreadBuffer();
+        buffer->events.emplace_back(std::forward<TArgs>(args)...);
+        buffer->orders.push_back(eventOrder);
+    }
 
-typedef std::list<std::unique_ptr<IEventCallback>> HandlerList;
+    void Deliver(EventBus &eventBus, bool sortByKey) override;
+};
 
 class EventBus
 {
 private:
-    std::map<std::type_index, std::unique_ptr<HandlerList>> subscribers;
+    // Handlers of every event type, indexed by EventType<TEvent>::GetId()
+    std::vector<std::vector<EventHandler>> subscribers;
+    std::vector<std::vector<EventBatchHandler>> batchSubscribers;
+    unsigned int nextSubscriptionId = 1;
+
+    // Queued events: the channels are published through atomics so any thread can find them,
+    // and owned (in creation order, which is also the delivery order) by the vector
+    std::array<std::atomic<IEventChannel *>, MAX_EVENT_TYPES> channels{};
+    std::vector<std::unique_ptr<IEventChannel>> ownedChannels;
+    // Only taken the first time an event type is queued
+    std::mutex channelsMutex;
+    bool deterministicOrder = false;
+
+    // Sort key and producer of the events queued by the calling thread
+    static EventOrder &CurrentOrder()
+    {
+        static thread_local EventOrder order{0, 0};
+        return order;
+    }
+
+    template <auto Callback>
+    static void InvokeHandler(void *owner, Event &event)
+    {
+        typedef EventCallbackTraits<decltype(Callback)> Traits;
+        (static_cast<typename Traits::owner *>(owner)->*Callback)(static_cast<typename Traits::event &>(event));
+    }
+
+    template <auto Callback>
+    static void InvokeBatchHandler(void *owner, void *events, size_t count)
+    {
+        typedef EventCallbackTraits<decltype(Callback)> Traits;
+        typedef typename Traits::event TEvent;
+        (static_cast<typename Traits::owner *>(owner)->*Callback)(EventSpan<TEvent>(static_cast<TEvent *>(events), count));
+    }
+
+    template <typename THandler>
+    static void AddHandler(std::vector<std::vector<THandler>> &handlers, int eventType, THandler handler)
+    {
+        if (eventType >= static_cast<int>(handlers.size()))
+        {
+            handlers.resize(eventType + 1);
+        }
+        handlers[eventType].push_back(handler);
+    }
+
+    template <typename THandler>
+    static void RemoveHandler(std::vector<std::vector<THandler>> &handlers, const EventSubscription &subscription)
+    {
+        if (subscription.eventType < 0 || subscription.eventType >= static_cast<int>(handlers.size()))
+        {
+            return;
+        }
+        auto &list = handlers[subscription.eventType];
+        list.erase(
+            std::remove_if(
+                list.begin(), list.end(),
+                [&subscription](const THandler &handler)
+                { return handler.id == subscription.id; }),
+            list.end());
+    }
+
+    template <typename TEvent>
+    EventChannel<TEvent> *GetOrCreateChannel()
+    {
+        const int eventType = EventType<TEvent>::GetId();
+        auto channel = channels[eventType].load(std::memory_order_acquire);
+        if (!channel)
+        {
+            std::lock_guard<std::mutex> lock(channelsMutex);
+            channel = channels[eventType].load(std::memory_order_relaxed);
+            if (!channel)
+            {
+                ownedChannels.push_back(std::make_unique<EventChannel<TEvent>>());
+                channel = ownedChannels.back().get();
+                channels[eventType].store(channel, std::memory_order_release);
+            }
+        }
+        return static_cast<EventChannel<TEvent> *>(channel);
+    }
 
 public:
     EventBus()
@@ -67,22 +305,41 @@ public:
     void Reset()
     {
         subscribers.clear();
+        batchSubscribers.clear();
     }
 
     ///////////////////////////////////////////////////////////////////////
     // Subscribe to an event type <T>
     // In our implementation, a listener subscribes to an event
-    // Example: eventBus->SubscribeToEvent<CollisionEvent>(this, &Game::onCollision);
+    // Example: eventBus->SubscribeToEvent<&Game::onCollision>(this);
+    // The event type is the parameter of the handler. Batch handlers
+    // (taking an EventSpan<T>) only receive queued events, all at once,
+    // when they are delivered; regular handlers receive emitted events
+    // and, one by one, the delivered queued events. The subscription
+    // persists until it is removed with Unsubscribe (never from inside a
+    // handler of the same event type) or Reset
     ///////////////////////////////////////////////////////////////////////
-    template <typename TEvent, typename TOwner>
-    void SubscribeToEvent(TOwner *ownerInstance, void (TOwner::*callbackFunction)(TEvent &))
+    template <auto Callback>
+    EventSubscription SubscribeToEvent(typename EventCallbackTraits<decltype(Callback)>::owner *ownerInstance)
     {
-        if (!subscribers[typeid(TEvent)].get())
+        typedef EventCallbackTraits<decltype(Callback)> Traits;
+        const int eventType = EventType<typename Traits::event>::GetId();
+        const unsigned int id = nextSubscriptionId++;
+        if constexpr (Traits::isBatch)
+        {
+            AddHandler(batchSubscribers, eventType, EventBatchHandler{ownerInstance, &InvokeBatchHandler<Callback>, id});
+        }
+        else
         {
-            subscribers[typeid(TEvent)] = std::make_unique<HandlerList>();
+            AddHandler(subscribers, eventType, EventHandler{ownerInstance, &InvokeHandler<Callback>, id});
         }
-        auto subscriber = std::make_unique<EventCallback<TOwner, TEvent>>(ownerInstance, callbackFunction);
-        subscribers[typeid(TEvent)]->push_back(std::move(subscriber));
+        return {eventType, id};
+    }
+
+    void Unsubscribe(const EventSubscription &subscription)
+    {
+        RemoveHandler(subscribers, subscription);
+        RemoveHandler(batchSubscribers, subscription);
     }
 
     ///////////////////////////////////////////////////////////////////////
@@ -90,20 +347,195 @@ public:
     // In our implementation, as soon as something emits an
     // event we go ahead and execute all the listener callback functions
     // Example: eventBus->EmitEvent<CollisionEvent>(player, enemy);
+    // The event is constructed once and shared by all the handlers
     ///////////////////////////////////////////////////////////////////////
     template <typename TEvent, typename... TArgs>
     void EmitEvent(TArgs &&...args)
     {
-        auto handlers = subscribers[typeid(TEvent)].get();
-        if (handlers)
+        const int eventType = EventType<TEvent>::GetId();
+        if (eventType >= static_cast<int>(subscribers.size()) || subscribers[eventType].empty())
+        {
+            return;
+        }
+        TEvent event(std::forward<TArgs>(args)...);
+        // A handler may subscribe new handlers while the event is dispatched, which can reallocate
+        // the handler arrays, so they are indexed again on every iteration (new handlers are skipped)
+        const size_t numHandlers = subscribers[eventType].size();
+        for (size_t i = 0; i < numHandlers && i < subscribers[eventType].size(); i++)
+        {
+            const EventHandler handler = subscribers[eventType][i];
+            handler.invoke(handler.owner, event);
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////
+    // Queue an event of type <T> instead of dispatching it right away
+    // The event is appended to the contiguous buffer of its type (safe to
+    // call from any thread, without locks) and handed to the handlers,
+    // together with the rest of the batch, by the next DeliverQueuedEvents()
+    // Example: eventBus->QueueEvent<CollisionEvent>(player, enemy);
+    ///////////////////////////////////////////////////////////////////////
+    template <typename TEvent, typename... TArgs>
+    void QueueEvent(TArgs &&...args)
+    {
+        if (EventType<TEvent>::GetId() >= MAX_EVENT_TYPES)
+        {
+            Logger::Err("Too many event types to queue (the maximum is " + std::to_string(MAX_EVENT_TYPES) + ")");
+            return;
+        }
+        GetOrCreateChannel<TEvent>()->Push(CurrentOrder(), std::forward<TArgs>(args)...);
+    }
+
+    // Events queued by the calling thread from now on are ordered by this key when the
+    // deterministic order is enabled (use something stable like the id of the emitting entity)
+    void SetSortKey(int key)
+    {
+        CurrentOrder().sortKey = key;
+    }
+
+    // Events queued by the calling thread from now on are ordered by this producer among the
+    // events with the same sort key (give every job that queues events its own index, e.g. its
+    // position in a ParallelFor, so the order does not depend on which thread ran it)
+    void SetProducer(int producer)
+    {
+        CurrentOrder().producer = producer;
+    }
+
+    // By default the batches keep the events of each thread in order, but the order between
+    // threads depends on timing. With the deterministic order, the batches are sorted by sort key,
+    // then by producer and then by the order each producer queued them in
+    void SetDeterministicOrder(bool enabled)
+    {
+        deterministicOrder = enabled;
+    }
+
+    // Hand every queued event to its handlers, one event type after another (call it from the
+    // main thread at the point of the frame where the events should be handled). Events queued
+    // by the handlers wait for the next delivery
+    void DeliverQueuedEvents()
+    {
+        for (size_t i = 0; i < ownedChannels.size(); i++)
+        {
+            ownedChannels[i]->Deliver(*this, deterministicOrder);
+        }
+    }
+
+    // Run the handlers of a batch of events of type <T>: each batch handler gets the whole
+    // span, each regular handler loops over all the events before the next handler runs
+    template <typename TEvent>
+    void DeliverBatch(TEvent *events, size_t count)
+    {
+        const int eventType = EventType<TEvent>::GetId();
+        if (count == 0)
+        {
+            return;
+        }
+        if (eventType < static_cast<int>(batchSubscribers.size()))
         {
-            for (auto it = handlers->begin(); it != handlers->end(); it++)
+            // Indexed again on every iteration, like in EmitEvent
+            const size_t numHandlers = batchSubscribers[eventType].size();
+            for (size_t i = 0; i < numHandlers && i < batchSubscribers[eventType].size(); i++)
             {
-                auto handler = it->get();
-                TEvent event(std::forward<TArgs>(args)...);
-                handler->Execute(event);
+                const EventBatchHandler handler = batchSubscribers[eventType][i];
+                handler.invoke(handler.owner, events, count);
             }
         }
+        if (eventType < static_cast<int>(subscribers.size()))
+        {
+            const size_t numHandlers = subscribers[eventType].size();
+            for (size_t i = 0; i < numHandlers && i < subscribers[eventType].size(); i++)
+            {
+                const EventHandler handler = subscribers[eventType][i];
+                for (size_t j = 0; j < count; j++)
+                {
+                    handler.invoke(handler.owner, events[j]);
+                }
+            }
+        }
+    }
+};
+
+template <typename TEvent>
+void EventChannel<TEvent>::Deliver(EventBus &eventBus, bool sortByKey)
+{
+    // Merge the buffers of all the threads (oldest buffer first) and empty them
+    std::vector<ThreadBuffer *> threadBuffers;
+    for (auto buffer = buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next)
+    {
+        threadBuffers.push_back(buffer);
+    }
+    for (auto it = threadBuffers.rbegin(); it != threadBuffers.rend(); it++)
+    {
+        auto buffer = *it;
+        std::move(buffer->events.begin(), buffer->events.end(), std::back_inserter(delivering));
+        deliveringOrders.insert(deliveringOrders.end(), buffer->orders.begin(), buffer->orders.end());
+        buffer->events.clear();
+        buffer->orders.clear();
+    }
+
+    if (sortByKey && delivering.size() > 1)
+    {
+        order.resize(delivering.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [this](int a, int b)
+                         { return deliveringOrders[a] < deliveringOrders[b]; });
+        std::vector<TEvent> sorted;
+        sorted.reserve(delivering.size());
+        for (auto index : order)
+        {
+            sorted.push_back(std::move(delivering[index]));
+        }
+        delivering.swap(sorted);
+    }
+
+    eventBus.DeliverBatch(delivering.data(), delivering.size());
+    delivering.clear();
+    deliveringOrders.clear();
+}
+
+///////////////////////////////////////////////////////////////////////
+// Subscriptions owned by an object (usually a system, which keeps them
+// in a member): they are all removed from the bus when the owner is
+// destroyed, so the bus never calls back into a dead object. The bus
+// must outlive its owners
+///////////////////////////////////////////////////////////////////////
+class ScopedSubscriptions
+{
+private:
+    EventBus *eventBus = nullptr;
+    std::vector<EventSubscription> subscriptions;
+
+public:
+    ScopedSubscriptions() = default;
+    ScopedSubscriptions(const ScopedSubscriptions &) = delete;
+    ScopedSubscriptions &operator=(const ScopedSubscriptions &) = delete;
+
+    ~ScopedSubscriptions()
+    {
+        Clear();
+    }
+
+    template <auto Callback>
+    void Subscribe(EventBus &bus, typename EventCallbackTraits<decltype(Callback)>::owner *ownerInstance)
+    {
+        if (eventBus && eventBus != &bus)
+        {
+            Clear();
+        }
+        eventBus = &bus;
+        subscriptions.push_back(bus.template SubscribeToEvent<Callback>(ownerInstance));
+    }
+
+    void Clear()
+    {
+        for (const auto &subscription : subscriptions)
+        {
+            eventBus->Unsubscribe(subscription);
+        }
+        subscriptions.clear();
     }
 };
 
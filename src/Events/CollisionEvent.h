@@ -3,13 +3,16 @@
 
 #include "../ECS/ECS.h"
 #include "../EventBus/Event.h"
+#include "../Physics/CollisionLayers.h"
 
 class CollisionEvent : public Event
 {
 public:
     Entity a;
     Entity b;
-    CollisionEvent(Entity a, Entity b) : a(a), b(b) {}
+    // Interaction of the pair, "a" is in the first layer of the type (e.g. the projectile)
+    CollisionPairType type;
+    CollisionEvent(Entity a, Entity b, CollisionPairType type = COLLISION_PAIR_OTHER) : a(a), b(b), type(type) {}
 };
 
 #endif
\ No newline at end of file
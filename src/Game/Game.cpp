@@ -33,6 +33,8 @@ Game::Game()
     registry = std::make_unique<Registry>();
     assetStore = std::make_unique<AssetStore>();
     eventBus = std::make_unique<EventBus>();
+    frameArena = std::make_unique<FrameArena>();
+    jobSystem = std::make_unique<JobSystem>();
     Logger::Log("Game constructor called!");
 }
 
@@ -140,6 +142,31 @@ void Game::Setup()
     registry->AddSystem<ScriptSystem>();
 
     registry->GetSystem<ScriptSystem>().CreateLuaBindings(lua);
+    registry->GetSystem<RenderHealthBarSystem>().ObserveComponents(registry);
+    registry->GetSystem<ProjectileEmitSystem>().CreatePrefabs(registry);
+    registry->GetSystem<RenderGUISystem>().CreatePrefabs(registry);
+
+    // The systems stay subscribed to their events until they are destroyed
+    registry->GetSystem<MovementSystem>().SubscribeToEvents(eventBus);
+    registry->GetSystem<DamageSystem>().SubscribeToEvents(eventBus);
+    registry->GetSystem<KeyboardControlSystem>().SubscribeToEvents(eventBus);
+    registry->GetSystem<ProjectileEmitSystem>().SubscribeToEvents(eventBus);
+
+    // Schedule the update systems in order; systems that don't conflict run in parallel
+    registry->ScheduleSystem<MovementSystem>([this]
+                                             { registry->GetSystem<MovementSystem>().Update(registry, *jobSystem, deltaTime); });
+    registry->ScheduleSystem<AnimationSystem>([this]
+                                              { registry->GetSystem<AnimationSystem>().Update(registry, *jobSystem); });
+    registry->ScheduleSystem<CollisionSystem>([this]
+                                              { registry->GetSystem<CollisionSystem>().Update(eventBus); });
+    registry->ScheduleSystem<ProjectileEmitSystem>([this]
+                                                   { registry->GetSystem<ProjectileEmitSystem>().Update(registry); });
+    registry->ScheduleSystem<CameraMovementSystem>([this]
+                                                   { registry->GetSystem<CameraMovementSystem>().Update(camera); });
+    registry->ScheduleSystem<ProjectileLifecycleSystem>([this]
+                                                        { registry->GetSystem<ProjectileLifecycleSystem>().Update(); });
+    registry->ScheduleSystem<ScriptSystem>([this]
+                                           { registry->GetSystem<ScriptSystem>().Update(deltaTime, SDL_GetTicks()); });
 
     // Load the first level
     LevelLoader loader;
@@ -150,27 +177,16 @@ void Game::Setup()
 void Game::Update()
 {
     // The difference in ticks since the last frame, converted to seconds
-    double deltaTime = (SDL_GetTicks() - millisecsPreviousFrame) / 1000.0;
+    deltaTime = (SDL_GetTicks() - millisecsPreviousFrame) / 1000.0;
 
     // Store the "previous" frame time
     millisecsPreviousFrame = SDL_GetTicks();
 
-    // Reset all event handlers for the current frame
-    eventBus->Reset();
-
-    registry->GetSystem<MovementSystem>().SubscribeToEvents(eventBus);
-    registry->GetSystem<DamageSystem>().SubscribeToEvents(eventBus);
-    registry->GetSystem<KeyboardControlSystem>().SubscribeToEvents(eventBus);
-    registry->GetSystem<ProjectileEmitSystem>().SubscribeToEvents(eventBus);
-
     registry->Update();
-    registry->GetSystem<MovementSystem>().Update(deltaTime);
-    registry->GetSystem<AnimationSystem>().Update();
-    registry->GetSystem<CollisionSystem>().Update(eventBus);
-    registry->GetSystem<ProjectileEmitSystem>().Update(registry);
-    registry->GetSystem<CameraMovementSystem>().Update(camera);
-    registry->GetSystem<ProjectileLifecycleSystem>().Update();
-    registry->GetSystem<ScriptSystem>().Update(deltaTime, SDL_GetTicks());
+    registry->RunScheduledSystems(*jobSystem);
+
+    // Handle the events queued by the systems during the frame
+    eventBus->DeliverQueuedEvents();
 }
 
 void Game::Render()
@@ -179,9 +195,9 @@ void Game::Render()
     SDL_RenderClear(renderer);
 
     // Invoke all the systems that need to render
-    registry->GetSystem<RenderSystem>().Update(renderer, assetStore, camera);
+    registry->GetSystem<RenderSystem>().Update(registry, *frameArena, renderer, assetStore, camera);
     registry->GetSystem<RenderTextSystem>().Update(renderer, assetStore, camera);
-    registry->GetSystem<RenderHealthBarSystem>().Update(renderer, assetStore, camera);
+    registry->GetSystem<RenderHealthBarSystem>().Update(registry, renderer, assetStore, camera);
     if (isDebug)
     {
         registry->GetSystem<RenderColliderSystem>().Update(renderer, camera);
@@ -199,11 +215,13 @@ void Game::Run()
         ProcessInput();
         Update();
         Render();
+        frameArena->Reset();
     }
 }
 
 void Game::Destroy()
 {
+    registry->GetSystem<RenderHealthBarSystem>().ClearHealthLabels();
     ImGuiSDL::Deinitialize();
     ImGui::DestroyContext();
     SDL_DestroyRenderer(renderer);
@@ -4,6 +4,7 @@
 #include "../ECS/ECS.h"
 #include "../AssetStore/AssetStore.h"
 #include "../EventBus/EventBus.h"
+#include "../Memory/FrameArena.h"
 #include <SDL2/SDL.h>
 #include <sol/sol.hpp>
 
@@ -16,15 +17,23 @@ private:
     bool isRunning;
     bool isDebug;
     int millisecsPreviousFrame = 0;
+    double deltaTime = 0.0;
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Rect camera;
 
     sol::state lua;
 
+    // Declared before the registry so it outlives the subscriptions held by the systems
+    std::unique_ptr<EventBus> eventBus;
     std::unique_ptr<Registry> registry;
     std::unique_ptr<AssetStore> assetStore;
-    std::unique_ptr<EventBus> eventBus;
+
+    // Scratch memory for the systems, reset at the end of every frame
+    std::unique_ptr<FrameArena> frameArena;
+
+    // Worker threads used to run independent systems in parallel
+    std::unique_ptr<JobSystem> jobSystem;
 
 public:
     Game();
@@ -15,6 +15,38 @@
 #include <string>
 #include <sol/sol.hpp>
 
+// Collision layer of a "layer" name of the level script, falling back to the layer
+// that matches the tag or group of the entity for the colliders that don't set one
+static int GetColliderLayer(sol::optional<std::string> layerName, sol::optional<std::string> tag, sol::optional<std::string> group)
+{
+    if (layerName != sol::nullopt)
+    {
+        const int layer = CollisionLayers::GetLayer(layerName.value());
+        if (IsValidCollisionLayer(layer))
+        {
+            return layer;
+        }
+        Logger::Err("Unknown collision layer: " + layerName.value());
+    }
+    if (tag != sol::nullopt && tag.value() == "player")
+    {
+        return COLLISION_LAYER_PLAYER;
+    }
+    if (group != sol::nullopt && group.value() == "enemies")
+    {
+        return COLLISION_LAYER_ENEMY;
+    }
+    if (group != sol::nullopt && group.value() == "obstacles")
+    {
+        return COLLISION_LAYER_OBSTACLE;
+    }
+    if (group != sol::nullopt && group.value() == "projectiles")
+    {
+        return COLLISION_LAYER_PROJECTILE;
+    }
+    return COLLISION_LAYER_DEFAULT;
+}
+
 LevelLoader::LevelLoader()
 {
     Logger::Log("LevelLoader constructor called!");
@@ -84,6 +116,12 @@ void LevelLoader::LoadLevel(sol::state &lua, const std::unique_ptr<Registry> &re
     double mapScale = map["scale"];
     std::fstream mapFile;
     mapFile.open(mapFilePath);
+    std::vector<Entity> tiles = registry->CreateEntities(mapNumRows * mapNumCols);
+    if (static_cast<int>(tiles.size()) < mapNumRows * mapNumCols)
+    {
+        Logger::Err("Not enough entities left for the tilemap");
+        return;
+    }
     for (int y = 0; y < mapNumRows; y++)
     {
         for (int x = 0; x < mapNumCols; x++)
@@ -95,9 +133,10 @@ void LevelLoader::LoadLevel(sol::state &lua, const std::unique_ptr<Registry> &re
             int srcRectX = std::atoi(&ch) * tileSize;
             mapFile.ignore();
 
-            Entity tile = registry->CreateEntity();
-            tile.AddComponent<TransformComponent>(glm::vec2(x * (mapScale * tileSize), y * (mapScale * tileSize)), glm::vec2(mapScale, mapScale), 0.0);
-            tile.AddComponent<SpriteComponent>(mapTextureAssetId, tileSize, tileSize, 0, false, srcRectX, srcRectY);
+            Entity tile = tiles[y * mapNumCols + x];
+            tile.AddComponents(
+                TransformComponent(glm::vec2(x * (mapScale * tileSize), y * (mapScale * tileSize)), glm::vec2(mapScale, mapScale), 0.0),
+                SpriteComponent(mapTextureAssetId, tileSize, tileSize, 0, false, srcRectX, srcRectY));
         }
     }
     mapFile.close();
@@ -120,19 +159,23 @@ void LevelLoader::LoadLevel(sol::state &lua, const std::unique_ptr<Registry> &re
         sol::table entity = entities[i];
 
         Entity newEntity = registry->CreateEntity();
+        if (!newEntity.IsValid())
+        {
+            break;
+        }
 
         // Tag
         sol::optional<std::string> tag = entity["tag"];
         if (tag != sol::nullopt)
         {
-            newEntity.Tag(entity["tag"]);
+            newEntity.Tag(tag.value());
         }
 
         // Group
         sol::optional<std::string> group = entity["group"];
         if (group != sol::nullopt)
         {
-            newEntity.Group(entity["group"]);
+            newEntity.Group(group.value());
         }
 
         // Components
@@ -190,12 +233,34 @@ void LevelLoader::LoadLevel(sol::state &lua, const std::unique_ptr<Registry> &re
             sol::optional<sol::table> collider = entity["components"]["boxcollider"];
             if (collider != sol::nullopt)
             {
+                // Optional layer name and list of layer names to collide with (e.g. mask = { "player", "enemy" })
+                sol::optional<std::string> layerName = entity["components"]["boxcollider"]["layer"];
+                const int layer = GetColliderLayer(layerName, tag, group);
+                CollisionMask mask = CollisionLayers::GetDefaultMask(layer);
+                sol::optional<sol::table> maskNames = entity["components"]["boxcollider"]["mask"];
+                if (maskNames != sol::nullopt)
+                {
+                    mask = 0;
+                    for (const auto &maskName : maskNames.value())
+                    {
+                        const int maskLayer = CollisionLayers::GetLayer(maskName.second.as<std::string>());
+                        if (!IsValidCollisionLayer(maskLayer))
+                        {
+                            Logger::Err("Unknown collision layer: " + maskName.second.as<std::string>());
+                            continue;
+                        }
+                        mask |= GetCollisionLayerBit(maskLayer);
+                    }
+                }
+
                 newEntity.AddComponent<BoxColliderComponent>(
                     entity["components"]["boxcollider"]["width"],
                     entity["components"]["boxcollider"]["height"],
                     glm::vec2(
                         entity["components"]["boxcollider"]["offset"]["x"].get_or(0),
-                        entity["components"]["boxcollider"]["offset"]["y"].get_or(0)));
+                        entity["components"]["boxcollider"]["offset"]["y"].get_or(0)),
+                    layer,
+                    mask);
             }
 
             // Health
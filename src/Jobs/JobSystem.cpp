@@ -0,0 +1,161 @@
+#include "./JobSystem.h"
+#include "../Logger/Logger.h"
+#include <string>
+
+// The job system and queue the current thread works for (only set on worker threads)
+static thread_local const JobSystem *currentJobSystem = nullptr;
+static thread_local int currentWorkerIndex = -1;
+
+JobSystem::JobSystem(int numWorkers)
+{
+    isRunning = true;
+    for (int i = 0; i < numWorkers + 1; i++)
+    {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (int i = 0; i < numWorkers; i++)
+    {
+        workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+    }
+    Logger::Log("JobSystem created with " + std::to_string(numWorkers) + " workers");
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        isRunning = false;
+    }
+    sleepCondition.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    Logger::Log("JobSystem destroyed");
+}
+
+int JobSystem::GetDefaultNumWorkers()
+{
+    const int hardwareThreads = std::thread::hardware_concurrency();
+    return hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+}
+
+int JobSystem::GetDefaultChunkSize(int count) const
+{
+    const int numChunks = (GetNumWorkers() + 1) * 4;
+    return std::max((count + numChunks - 1) / numChunks, 1);
+}
+
+int JobSystem::GetQueueIndex() const
+{
+    if (currentJobSystem == this)
+    {
+        return currentWorkerIndex;
+    }
+    return static_cast<int>(queues.size()) - 1;
+}
+
+void JobSystem::Submit(JobCounter &counter, std::function<void()> function)
+{
+    if (IsSingleThreaded())
+    {
+        function();
+        return;
+    }
+
+    counter.pendingJobs.fetch_add(1, std::memory_order_relaxed);
+    auto &queue = *queues[GetQueueIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back({std::move(function), &counter});
+    }
+    numQueuedJobs.fetch_add(1, std::memory_order_release);
+
+    // Take the sleep lock so a worker that is about to sleep doesn't miss the job
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    sleepCondition.notify_one();
+}
+
+bool JobSystem::PopJob(int queueIndex, Job &job)
+{
+    // Newest job from our own queue first
+    {
+        auto &queue = *queues[queueIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty())
+        {
+            job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+            return true;
+        }
+    }
+
+    // Otherwise steal the oldest job from another queue
+    const int numQueues = static_cast<int>(queues.size());
+    for (int i = 1; i < numQueues; i++)
+    {
+        auto &queue = *queues[(queueIndex + i) % numQueues];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty())
+        {
+            job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool JobSystem::RunPendingJob()
+{
+    if (numQueuedJobs.load(std::memory_order_acquire) == 0)
+    {
+        return false;
+    }
+
+    Job job;
+    if (!PopJob(GetQueueIndex(), job))
+    {
+        return false;
+    }
+    numQueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+    job.function();
+    job.counter->pendingJobs.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+void JobSystem::Wait(JobCounter &counter)
+{
+    // Help with the pending jobs instead of just blocking
+    while (!counter.IsDone())
+    {
+        if (!RunPendingJob())
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void JobSystem::WorkerLoop(int workerIndex)
+{
+    currentJobSystem = this;
+    currentWorkerIndex = workerIndex;
+
+    while (true)
+    {
+        if (RunPendingJob())
+        {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepCondition.wait(lock, [this]
+                            { return !isRunning || numQueuedJobs.load(std::memory_order_acquire) > 0; });
+        if (!isRunning)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,137 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tracks a group of submitted jobs so the caller can wait for all of them
+class JobCounter
+{
+private:
+    friend class JobSystem;
+    std::atomic<int> pendingJobs{0};
+
+public:
+    bool IsDone() const
+    {
+        return pendingJobs.load(std::memory_order_acquire) == 0;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// JobSystem
+////////////////////////////////////////////////////////////////////////////////
+// Work-stealing pool of worker threads. Every worker has its own queue: jobs
+// submitted from a worker go to the back of its queue and are taken back from
+// there (most recent first), while idle workers steal the oldest jobs from the
+// front of the other queues. Jobs submitted from any other thread go to a
+// shared queue. The thread that waits on a counter also runs pending jobs,
+// so a job system with zero workers simply runs everything on that thread
+////////////////////////////////////////////////////////////////////////////////
+class JobSystem
+{
+private:
+    struct Job
+    {
+        std::function<void()> function;
+        JobCounter *counter;
+    };
+
+    struct WorkQueue
+    {
+        std::deque<Job> jobs;
+        std::mutex mutex;
+    };
+
+    std::vector<std::thread> workers;
+
+    // One queue per worker plus the shared queue (the last one)
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+
+    // Number of jobs in all the queues, used to put idle workers to sleep
+    std::atomic<int> numQueuedJobs{0};
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    std::atomic<bool> isRunning;
+
+    // When set, jobs run immediately on the submitting thread in submission order
+    bool isSingleThreaded = false;
+
+    int GetQueueIndex() const;
+    bool PopJob(int queueIndex, Job &job);
+    bool RunPendingJob();
+    void WorkerLoop(int workerIndex);
+
+public:
+    JobSystem(int numWorkers = GetDefaultNumWorkers());
+    ~JobSystem();
+
+    // One worker per hardware thread, leaving one for the main thread
+    static int GetDefaultNumWorkers();
+
+    int GetNumWorkers() const
+    {
+        return static_cast<int>(workers.size());
+    }
+
+    // Deterministic fallback for debugging, only change it while no jobs are pending
+    void SetSingleThreaded(bool singleThreaded)
+    {
+        isSingleThreaded = singleThreaded;
+    }
+
+    bool IsSingleThreaded() const
+    {
+        return isSingleThreaded || workers.empty();
+    }
+
+    void Submit(JobCounter &counter, std::function<void()> function);
+    void Wait(JobCounter &counter);
+
+    // Split [0, count) in chunks of chunkSize elements (picked automatically if
+    // not positive) and call func(begin, end) for every chunk, in parallel
+    template <typename TFunc>
+    void ParallelFor(int count, int chunkSize, const TFunc &func);
+
+    // Chunk size that gives every thread a few chunks to balance the load
+    int GetDefaultChunkSize(int count) const;
+};
+
+template <typename TFunc>
+void JobSystem::ParallelFor(int count, int chunkSize, const TFunc &func)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+    if (chunkSize <= 0)
+    {
+        chunkSize = GetDefaultChunkSize(count);
+    }
+    if (IsSingleThreaded() || chunkSize >= count)
+    {
+        for (int begin = 0; begin < count; begin += chunkSize)
+        {
+            func(begin, std::min(begin + chunkSize, count));
+        }
+        return;
+    }
+
+    JobCounter counter;
+    for (int begin = 0; begin < count; begin += chunkSize)
+    {
+        const int end = std::min(begin + chunkSize, count);
+        Submit(counter, [&func, begin, end]
+               { func(begin, end); });
+    }
+    Wait(counter);
+}
+
+#endif
@@ -3,9 +3,13 @@
 #include <string>
 #include <chrono>
 #include <ctime>
+#include <mutex>
 
 std::vector<LogEntry> Logger::messages;
 
+// Systems may log from worker threads, so the log is guarded by a mutex
+static std::mutex logMutex;
+
 std::string CurrentDateTimeToString()
 {
     std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
@@ -16,6 +20,7 @@ std::string CurrentDateTimeToString()
 
 void Logger::Log(const std::string &message)
 {
+    std::lock_guard<std::mutex> lock(logMutex);
     LogEntry logEntry;
     logEntry.type = LOG_INFO;
     logEntry.message = "LOG: [" + CurrentDateTimeToString() + "]: " + message;
@@ -25,6 +30,7 @@ void Logger::Log(const std::string &message)
 
 void Logger::Err(const std::string &message)
 {
+    std::lock_guard<std::mutex> lock(logMutex);
     LogEntry logEntry;
     logEntry.type = LOG_ERROR;
     logEntry.message = "ERR: [" + CurrentDateTimeToString() + "]: " + message;
@@ -0,0 +1,42 @@
+#include "./FrameArena.h"
+#include "../Logger/Logger.h"
+#include <algorithm>
+#include <string>
+
+FrameArena::FrameArena(size_t capacity) : memory(new unsigned char[capacity]), capacity(capacity), offset(0), overflowBytes(0)
+{
+}
+
+void *FrameArena::Allocate(size_t size, size_t alignment)
+{
+    size_t alignedOffset = (offset + alignment - 1) / alignment * alignment;
+    if (alignedOffset + size <= capacity)
+    {
+        offset = alignedOffset + size;
+        return memory.get() + alignedOffset;
+    }
+
+    // The frame needs more memory than the arena has, fall back to a separate block for now
+    overflowBlocks.emplace_back(new unsigned char[size]);
+    overflowBytes += size;
+    return overflowBlocks.back().get();
+}
+
+void FrameArena::Reset()
+{
+    if (!overflowBlocks.empty())
+    {
+        // Grow the arena so the next frames fit in a single block
+        size_t newCapacity = std::max<size_t>(capacity, MIN_CAPACITY);
+        while (newCapacity < offset + overflowBytes)
+        {
+            newCapacity *= 2;
+        }
+        Logger::Log("Frame arena grown from " + std::to_string(capacity) + " to " + std::to_string(newCapacity) + " bytes");
+        memory.reset(new unsigned char[newCapacity]);
+        capacity = newCapacity;
+        overflowBlocks.clear();
+        overflowBytes = 0;
+    }
+    offset = 0;
+}
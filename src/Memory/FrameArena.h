@@ -0,0 +1,93 @@
+#ifndef FRAMEARENA_H
+#define FRAMEARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+// FrameArena
+////////////////////////////////////////////////////////////////////////////////
+// Linear allocator for data that only lives during one frame. Allocations
+// just bump an offset and nothing is freed individually: the whole arena is
+// reset at the end of the frame. If a frame needs more than the capacity, the
+// extra blocks are merged into a single bigger block on the next reset, so a
+// steady-state frame does no heap allocations at all
+////////////////////////////////////////////////////////////////////////////////
+class FrameArena
+{
+private:
+    std::unique_ptr<unsigned char[]> memory;
+    size_t capacity;
+    size_t offset;
+
+    // Blocks allocated when the main block overflowed during the current frame
+    std::vector<std::unique_ptr<unsigned char[]>> overflowBlocks;
+    size_t overflowBytes;
+
+    // Smallest capacity the arena grows to (doubling has to start from something when it was created empty)
+    static constexpr size_t MIN_CAPACITY = 4096;
+
+public:
+    FrameArena(size_t capacity = 1024 * 1024);
+    ~FrameArena() = default;
+
+    void *Allocate(size_t size, size_t alignment);
+    void Reset();
+
+    size_t GetCapacity() const
+    {
+        return capacity;
+    }
+
+    size_t GetUsed() const
+    {
+        return offset + overflowBytes;
+    }
+};
+
+// STL allocator that takes its memory from a FrameArena (deallocation is a no-op)
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    FrameArena *arena;
+
+    ArenaAllocator(FrameArena &arena) : arena(&arena)
+    {
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena)
+    {
+    }
+
+    T *allocate(size_t count)
+    {
+        return static_cast<T *>(arena->Allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, size_t)
+    {
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &other) const
+    {
+        return arena == other.arena;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const
+    {
+        return arena != other.arena;
+    }
+};
+
+// Vector whose storage lives in a FrameArena, only valid until the arena is reset
+template <typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif
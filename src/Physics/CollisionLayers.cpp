@@ -0,0 +1,78 @@
+#include "./CollisionLayers.h"
+#include <array>
+
+static const char *layerNames[NUM_COLLISION_LAYERS] = {"default", "player", "enemy", "obstacle", "projectile"};
+
+// Response of every ordered pair of layers
+static std::array<std::array<CollisionResponse, NUM_COLLISION_LAYERS>, NUM_COLLISION_LAYERS> CreateDefaultResponses()
+{
+    std::array<std::array<CollisionResponse, NUM_COLLISION_LAYERS>, NUM_COLLISION_LAYERS> responses;
+    for (auto &row : responses)
+    {
+        row.fill({COLLISION_PAIR_OTHER, false});
+    }
+    responses[COLLISION_LAYER_PROJECTILE][COLLISION_LAYER_PLAYER] = {COLLISION_PAIR_PROJECTILE_PLAYER, false};
+    responses[COLLISION_LAYER_PLAYER][COLLISION_LAYER_PROJECTILE] = {COLLISION_PAIR_PROJECTILE_PLAYER, true};
+    responses[COLLISION_LAYER_PROJECTILE][COLLISION_LAYER_ENEMY] = {COLLISION_PAIR_PROJECTILE_ENEMY, false};
+    responses[COLLISION_LAYER_ENEMY][COLLISION_LAYER_PROJECTILE] = {COLLISION_PAIR_PROJECTILE_ENEMY, true};
+    responses[COLLISION_LAYER_ENEMY][COLLISION_LAYER_OBSTACLE] = {COLLISION_PAIR_ENEMY_OBSTACLE, false};
+    responses[COLLISION_LAYER_OBSTACLE][COLLISION_LAYER_ENEMY] = {COLLISION_PAIR_ENEMY_OBSTACLE, true};
+    return responses;
+}
+
+static auto pairResponses = CreateDefaultResponses();
+
+int CollisionLayers::GetLayer(const std::string &name)
+{
+    for (int layer = 0; layer < NUM_COLLISION_LAYERS; layer++)
+    {
+        if (name == layerNames[layer])
+        {
+            return layer;
+        }
+    }
+    return -1;
+}
+
+CollisionMask CollisionLayers::GetDefaultMask(int layer)
+{
+    if (layer == COLLISION_LAYER_DEFAULT)
+    {
+        return COLLISION_MASK_ALL;
+    }
+    if (!IsValidCollisionLayer(layer))
+    {
+        return GetCollisionLayerBit(COLLISION_LAYER_DEFAULT);
+    }
+    CollisionMask mask = GetCollisionLayerBit(COLLISION_LAYER_DEFAULT);
+    for (int other = 0; other < NUM_COLLISION_LAYERS; other++)
+    {
+        if (pairResponses[layer][other].type != COLLISION_PAIR_OTHER)
+        {
+            mask |= GetCollisionLayerBit(other);
+        }
+    }
+    return mask;
+}
+
+void CollisionLayers::SetPairResponse(int first, int second, CollisionPairType type)
+{
+    if (!IsValidCollisionLayer(first) || !IsValidCollisionLayer(second))
+    {
+        return;
+    }
+    pairResponses[first][second] = {type, false};
+    if (first != second)
+    {
+        pairResponses[second][first] = {type, true};
+    }
+}
+
+CollisionResponse CollisionLayers::GetPairResponse(int layerA, int layerB)
+{
+    if (!IsValidCollisionLayer(layerA) || !IsValidCollisionLayer(layerB))
+    {
+        return {COLLISION_PAIR_OTHER, false};
+    }
+    return pairResponses[layerA][layerB];
+}
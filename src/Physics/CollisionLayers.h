@@ -0,0 +1,70 @@
+#ifndef COLLISIONLAYERS_H
+#define COLLISIONLAYERS_H
+
+#include <cstdint>
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////
+// Collision layers
+////////////////////////////////////////////////////////////////////////////////
+// Every collider belongs to one layer and has a mask with a bit per layer it
+// wants to collide with. The collision system only tests a pair when each
+// collider's mask contains the other's layer, and the pair-response table
+// tells which kind of interaction (if any) the two layers have, so handlers
+// can switch on the pair type instead of checking tags and groups
+////////////////////////////////////////////////////////////////////////////////
+enum CollisionLayer
+{
+    COLLISION_LAYER_DEFAULT,
+    COLLISION_LAYER_PLAYER,
+    COLLISION_LAYER_ENEMY,
+    COLLISION_LAYER_OBSTACLE,
+    COLLISION_LAYER_PROJECTILE,
+    NUM_COLLISION_LAYERS
+};
+
+typedef std::uint32_t CollisionMask;
+const CollisionMask COLLISION_MASK_ALL = 0xFFFFFFFF;
+
+inline bool IsValidCollisionLayer(int layer)
+{
+    return layer >= 0 && layer < NUM_COLLISION_LAYERS;
+}
+
+// Bit of the layer in a mask (no bit for an invalid layer)
+inline CollisionMask GetCollisionLayerBit(int layer)
+{
+    return IsValidCollisionLayer(layer) ? 1u << layer : 0;
+}
+
+// Interactions the game reacts to, named after the layers of the pair in order
+enum CollisionPairType
+{
+    COLLISION_PAIR_OTHER,
+    COLLISION_PAIR_PROJECTILE_PLAYER,
+    COLLISION_PAIR_PROJECTILE_ENEMY,
+    COLLISION_PAIR_ENEMY_OBSTACLE
+};
+
+struct CollisionResponse
+{
+    CollisionPairType type;
+    // True when the pair was looked up in the opposite order of its type
+    bool swapped;
+};
+
+class CollisionLayers
+{
+public:
+    // Layer of a name used by the level scripts ("player", "enemy", ...), -1 if it is unknown
+    static int GetLayer(const std::string &name);
+
+    // Mask of the layers that have a response with the layer (plus the default layer)
+    static CollisionMask GetDefaultMask(int layer);
+
+    // Invalid layers are ignored by SetPairResponse and have no response with any layer
+    static void SetPairResponse(int first, int second, CollisionPairType type);
+    static CollisionResponse GetPairResponse(int layerA, int layerB);
+};
+
+#endif
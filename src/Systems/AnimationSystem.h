@@ -13,18 +13,20 @@ public:
     {
         RequireComponent<SpriteComponent>();
         RequireComponent<AnimationComponent>();
+        WritesComponent<SpriteComponent>();
+        WritesComponent<AnimationComponent>();
     }
 
-    void Update()
+    void Update(const std::unique_ptr<Registry> &registry, JobSystem &jobSystem)
     {
-        for (auto entity : GetSystemEntities())
-        {
-            auto &animation = entity.GetComponent<AnimationComponent>();
-            auto &sprite = entity.GetComponent<SpriteComponent>();
-
-            animation.currentFrame = ((SDL_GetTicks() - animation.startTime) * animation.frameSpeedRate / 1000) % animation.numFrames;
-            sprite.srcRect.x = animation.currentFrame * sprite.width;
-        }
+        // Every entity uses the same time so all chunks agree on the current frame
+        const auto currentTicks = SDL_GetTicks();
+        const auto view = registry->View<AnimationComponent, SpriteComponent>();
+        jobSystem.ParallelFor(view.Size(), 0, [&view, currentTicks](int begin, int end)
+                              { view.Each(begin, end, [currentTicks](Entity entity, AnimationComponent &animation, SpriteComponent &sprite)
+                                          {
+                animation.currentFrame = ((currentTicks - animation.startTime) * animation.frameSpeedRate / 1000) % animation.numFrames;
+                sprite.srcRect.x = animation.currentFrame * sprite.width; }); });
     }
 };
 
@@ -14,6 +14,7 @@ public:
     {
         RequireComponent<CameraFollowComponent>();
         RequireComponent<TransformComponent>();
+        WritesResource(RESOURCE_CAMERA);
     }
 
     void Update(SDL_Rect &camera)
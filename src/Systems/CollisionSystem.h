@@ -14,11 +14,12 @@ public:
     {
         RequireComponent<TransformComponent>();
         RequireComponent<BoxColliderComponent>();
+        // Collision events are only queued (the handlers run when the bus delivers them)
     }
 
     void Update(std::unique_ptr<EventBus> &eventBus)
     {
-        auto entities = GetSystemEntities();
+        const auto &entities = GetSystemEntities();
         // Loop all the entities that the system is interested in
         for (auto i = entities.begin(); i != entities.end(); i++)
         {
@@ -37,9 +38,16 @@ public:
                     continue;
                 }
 
-                auto bTransform = b.GetComponent<TransformComponent>();
                 auto bCollider = b.GetComponent<BoxColliderComponent>();
 
+                // Skip the pairs whose layers do not interact
+                if (!(aCollider.mask & GetCollisionLayerBit(bCollider.layer)) || !(bCollider.mask & GetCollisionLayerBit(aCollider.layer)))
+                {
+                    continue;
+                }
+
+                auto bTransform = b.GetComponent<TransformComponent>();
+
                 // Perform the AABB collision check between entities a and b
                 bool collisionHappened = CheckAABBCollision(
                     aTransform.position.x + aCollider.offset.x,
@@ -53,7 +61,15 @@ public:
 
                 if (collisionHappened)
                 {
-                    eventBus->EmitEvent<CollisionEvent>(a, b);
+                    const auto response = CollisionLayers::GetPairResponse(aCollider.layer, bCollider.layer);
+                    if (response.swapped)
+                    {
+                        eventBus->QueueEvent<CollisionEvent>(b, a, response.type);
+                    }
+                    else
+                    {
+                        eventBus->QueueEvent<CollisionEvent>(a, b, response.type);
+                    }
                     Logger::Err("Entity " + std::to_string(a.GetId()) + " is colliding with entity " + std::to_string(b.GetId()));
                 }
             }
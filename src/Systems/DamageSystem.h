@@ -10,6 +10,9 @@
 
 class DamageSystem : public System
 {
+private:
+    ScopedSubscriptions subscriptions;
+
 public:
     DamageSystem()
     {
@@ -18,7 +21,16 @@ public:
 
     void SubscribeToEvents(std::unique_ptr<EventBus> &eventBus)
     {
-        eventBus->SubscribeToEvent<CollisionEvent>(this, &DamageSystem::OnCollision);
+        subscriptions.Subscribe<&DamageSystem::OnCollisions>(*eventBus, this);
+    }
+
+    // Collisions are queued by the collision system and delivered in one batch per frame
+    void OnCollisions(EventSpan<CollisionEvent> events)
+    {
+        for (auto &event : events)
+        {
+            OnCollision(event);
+        }
     }
 
     void OnCollision(CollisionEvent &event)
@@ -27,70 +39,82 @@ public:
         Entity b = event.b;
         Logger::Log("Collision event emitted: " + std::to_string(a.GetId()) + " and " + std::to_string(b.GetId()));
 
-        if (a.BelongsToGroup("projectiles") && b.HasTag("player"))
+        switch (event.type)
         {
+        case COLLISION_PAIR_PROJECTILE_PLAYER:
             OnProjectileHitsPlayer(a, b); // "a" is the projectile, "b" is the player
-        }
-
-        if (b.BelongsToGroup("projectiles") && a.HasTag("player"))
-        {
-            OnProjectileHitsPlayer(b, a); // "b" is the projectile, "a" is the player
-        }
-
-        if (a.BelongsToGroup("projectiles") && b.BelongsToGroup("enemies"))
-        {
+            break;
+        case COLLISION_PAIR_PROJECTILE_ENEMY:
             OnProjectileHitsEnemy(a, b); // "a" is the projectile, "b" is the enemy
-        }
-
-        if (b.BelongsToGroup("projectiles") && a.BelongsToGroup("enemies"))
-        {
-            OnProjectileHitsEnemy(b, a); // "b" is the projectile, "a" is the enemy
+            break;
+        default:
+            break;
         }
     }
 
     void OnProjectileHitsPlayer(Entity projectile, Entity player)
     {
+        // The layers say nothing about the components: anything can be put in the projectile layer
+        if (!projectile.HasComponent<ProjectileComponent>())
+        {
+            return;
+        }
         const auto projectileComponent = projectile.GetComponent<ProjectileComponent>();
+        // Key the commands by projectile, then give the thread its previous key back
+        auto &commands = projectile.registry->GetCommandBuffer();
+        const int previousSortKey = commands.GetSortKey();
+        commands.SetSortKey(projectile.GetId());
 
-        if (!projectileComponent.isFriendly)
+        if (!projectileComponent.isFriendly && player.HasComponent<HealthComponent>())
         {
             // Reduce the health of the player by the projectile hitPercentDamage
             auto &health = player.GetComponent<HealthComponent>();
 
             // Subtract the health of the player
             health.healthPercentage -= projectileComponent.hitPercentDamage;
+            player.MarkChanged<HealthComponent>();
 
             // Kills the player when health reaches zero
             if (health.healthPercentage <= 0)
             {
-                player.Kill();
+                commands.KillEntity(player);
             }
 
             // Kill the projectile
-            projectile.Kill();
+            commands.KillEntity(projectile);
         }
+        commands.SetSortKey(previousSortKey);
     }
 
     void OnProjectileHitsEnemy(Entity projectile, Entity enemy)
     {
+        if (!projectile.HasComponent<ProjectileComponent>())
+        {
+            return;
+        }
         const auto projectileComponent = projectile.GetComponent<ProjectileComponent>();
+        auto &commands = projectile.registry->GetCommandBuffer();
+        const int previousSortKey = commands.GetSortKey();
+        commands.SetSortKey(projectile.GetId());
 
         // Only damage the enemy if projectile is friendly
-        if (projectileComponent.isFriendly)
+        if (projectileComponent.isFriendly && enemy.HasComponent<HealthComponent>())
         {
             auto &health = enemy.GetComponent<HealthComponent>();
 
             // Subtract from enemy health
             health.healthPercentage -= projectileComponent.hitPercentDamage;
+            enemy.MarkChanged<HealthComponent>();
 
             // Kills the enemy if health reaches zero
             if (health.healthPercentage <= 0)
             {
-                enemy.Kill();
+                commands.KillEntity(enemy);
             }
             // Destroy projectile
-            projectile.Kill();
+            commands.KillEntity(projectile);
         }
+        commands.SetSortKey(previousSortKey);
     }
 };
 
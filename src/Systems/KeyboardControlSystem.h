@@ -10,6 +10,9 @@
 
 class KeyboardControlSystem : public System
 {
+private:
+    ScopedSubscriptions subscriptions;
+
 public:
     KeyboardControlSystem()
     {
@@ -20,7 +23,7 @@ public:
 
     void SubscribeToEvents(std::unique_ptr<EventBus> &eventBus)
     {
-        eventBus->SubscribeToEvent<KeyPressedEvent>(this, &KeyboardControlSystem::OnKeyPressed);
+        subscriptions.Subscribe<&KeyboardControlSystem::OnKeyPressed>(*eventBus, this);
     }
 
     void OnKeyPressed(KeyPressedEvent &event)
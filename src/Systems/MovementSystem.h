@@ -11,16 +11,77 @@
 
 class MovementSystem : public System
 {
+private:
+    ScopedSubscriptions subscriptions;
+
+    const TagId playerTag = Registry::GetTagId("player");
+
+    // Number of entities moved by each job
+    static const int CHUNK_SIZE = 256;
+
+    // Entities found outside the map by each chunk, killed after the parallel loop
+    std::vector<std::vector<Entity>> entitiesOutsideMap;
+
+    // Padding that keeps the player inside the map
+    static const int PADDING_LEFT = 10;
+    static const int PADDING_TOP = 10;
+    static const int PADDING_RIGHT = 50;
+    static const int PADDING_BOTTOM = 50;
+
+    typedef OwningGroup<TransformComponent, RigidBodyComponent> MovementGroup;
+
+    void UpdateChunk(const MovementGroup &group, int begin, int end, double deltaTime, int playerId, std::vector<Entity> &outsideMap)
+    {
+        group.Each(begin, end, [&outsideMap, deltaTime, playerId](Entity entity, TransformComponent &transform, const RigidBodyComponent &rigidbody)
+                   {
+            // Update the entity position based on its velocity
+            transform.position.x += rigidbody.velocity.x * deltaTime;
+            transform.position.y += rigidbody.velocity.y * deltaTime;
+
+            // Prevent the main player from moving outside the map boundaries
+            const bool isPlayer = entity.GetId() == playerId;
+            if (isPlayer)
+            {
+                transform.position.x = transform.position.x < PADDING_LEFT ? PADDING_LEFT : transform.position.x;
+                transform.position.x = transform.position.x > Game::mapWidth - PADDING_RIGHT ? Game::mapWidth - PADDING_RIGHT : transform.position.x;
+                transform.position.y = transform.position.y < PADDING_TOP ? PADDING_TOP : transform.position.y;
+                transform.position.y = transform.position.y > Game::mapHeight - PADDING_BOTTOM ? Game::mapHeight - PADDING_BOTTOM : transform.position.y;
+            }
+
+            // Check if entity is outside the map boundaries
+            bool isEntityOutsideMap = (transform.position.x < 0 ||
+                                       transform.position.x > Game::mapWidth ||
+                                       transform.position.y < 0 ||
+                                       transform.position.y > Game::mapHeight);
+
+            // Remember the entities that move outside the map boundaries (killing isn't thread safe)
+            if (isEntityOutsideMap && !isPlayer)
+            {
+                outsideMap.push_back(entity);
+            } });
+    }
+
 public:
     MovementSystem()
     {
         RequireComponent<TransformComponent>();
         RequireComponent<RigidBodyComponent>();
+        WritesComponent<TransformComponent>();
+        WritesResource(RESOURCE_ENTITIES);
     }
 
     void SubscribeToEvents(const std::unique_ptr<EventBus> &eventBus)
     {
-        eventBus->SubscribeToEvent<CollisionEvent>(this, &MovementSystem::OnCollision);
+        subscriptions.Subscribe<&MovementSystem::OnCollisions>(*eventBus, this);
+    }
+
+    // Enemies bounce off the obstacles they overlapped during the frame
+    void OnCollisions(EventSpan<CollisionEvent> events)
+    {
+        for (auto &event : events)
+        {
+            OnCollision(event);
+        }
     }
 
     void OnCollision(CollisionEvent &event)
@@ -29,15 +90,10 @@ public:
         Entity b = event.b;
         Logger::Log("Collision event emitted: " + std::to_string(a.GetId()) + " and " + std::to_string(b.GetId()));
 
-        if (a.BelongsToGroup("enemies") && b.BelongsToGroup("obstacles"))
+        if (event.type == COLLISION_PAIR_ENEMY_OBSTACLE)
         {
             OnEnemyHitsObstacle(a, b); // "a" is the enemy, "b" is the obstacle
         }
-
-        if (a.BelongsToGroup("obstacles") && b.BelongsToGroup("enemies"))
-        {
-            OnEnemyHitsObstacle(b, a); // "b" is the enemy, "a" is the obstacle
-        }
     }
 
     void OnEnemyHitsObstacle(Entity enemy, Entity obstacle)
@@ -61,40 +117,31 @@ public:
         }
     }
 
-    void Update(double deltaTime)
+    void Update(const std::unique_ptr<Registry> &registry, JobSystem &jobSystem, double deltaTime)
     {
-        // Loop all entities that the system is interested in
-        for (auto entity : GetSystemEntities())
+        // Loop all entities that have both a transform and a rigid body, split in chunks across the job system
+        // (the owning group keeps both pools packed in the same order, so the chunks are walked linearly)
+        const auto group = registry->Group<TransformComponent, RigidBodyComponent>();
+        const int numEntities = group.Size();
+        const int numChunks = (numEntities + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        if (static_cast<int>(entitiesOutsideMap.size()) < numChunks)
         {
-            // Update entity position based on its velocity
-            auto &transform = entity.GetComponent<TransformComponent>();
-            const auto rigidbody = entity.GetComponent<RigidBodyComponent>();
-
-            // Update the entity position based on its velocity
-            transform.position.x += rigidbody.velocity.x * deltaTime;
-            transform.position.y += rigidbody.velocity.y * deltaTime;
+            entitiesOutsideMap.resize(numChunks);
+        }
 
-            // Prevent the main player from moving outside the map boundaries
-            if (entity.HasTag("player"))
-            {
-                int paddingLeft = 10;
-                int paddingTop = 10;
-                int paddingRight = 50;
-                int paddingBottom = 50;
-                transform.position.x = transform.position.x < paddingLeft ? paddingLeft : transform.position.x;
-                transform.position.x = transform.position.x > Game::mapWidth - paddingRight ? Game::mapWidth - paddingRight : transform.position.x;
-                transform.position.y = transform.position.y < paddingTop ? paddingTop : transform.position.y;
-                transform.position.y = transform.position.y > Game::mapHeight - paddingBottom ? Game::mapHeight - paddingBottom : transform.position.y;
-            }
+        // Look the player up once instead of checking the tag of every entity
+        const int playerId = registry->GetEntityByTag(playerTag).GetId();
 
-            // Check if entity is outside the map boundaries
-            bool isEntityOutsideMap = (transform.position.x < 0 ||
-                                       transform.position.x > Game::mapWidth ||
-                                       transform.position.y < 0 ||
-                                       transform.position.y > Game::mapHeight);
+        jobSystem.ParallelFor(numEntities, CHUNK_SIZE, [this, &group, deltaTime, playerId](int begin, int end)
+                              {
+            auto &outsideMap = entitiesOutsideMap[begin / CHUNK_SIZE];
+            outsideMap.clear();
+            UpdateChunk(group, begin, end, deltaTime, playerId, outsideMap); });
 
-            // Kill all entities that move outside the map boundaries
-            if (isEntityOutsideMap && !entity.HasTag("player"))
+        // Kill all entities that moved outside the map boundaries, in a deterministic order
+        for (int chunk = 0; chunk < numChunks; chunk++)
+        {
+            for (auto entity : entitiesOutsideMap[chunk])
             {
                 entity.Kill();
             }
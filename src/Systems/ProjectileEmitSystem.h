@@ -15,16 +15,52 @@
 
 class ProjectileEmitSystem : public System
 {
+private:
+    ScopedSubscriptions subscriptions;
+
+    const TagId playerTag = Registry::GetTagId("player");
+    const GroupId projectilesGroup = Registry::GetGroupId("projectiles");
+
+    // Components shared by every projectile (sprite, collider and group)
+    PrefabId projectilePrefab = -1;
+
+    // Record the creation of a projectile, it is added to the registry on its next update
+    void EmitProjectile(Entity emitter, glm::vec2 position, glm::vec2 velocity, const ProjectileEmitterComponent &projectileEmitter)
+    {
+        auto &commands = emitter.registry->GetCommandBuffer();
+        const int previousSortKey = commands.GetSortKey();
+        commands.SetSortKey(emitter.GetId());
+        DeferredEntity projectile = commands.Instantiate(projectilePrefab);
+        commands.AddComponents(
+            projectile,
+            TransformComponent(position, glm::vec2(1.0, 1.0), 0.0),
+            RigidBodyComponent(velocity),
+            ProjectileComponent(projectileEmitter.isFriendly, projectileEmitter.hitPercentDamage, projectileEmitter.projectileDuration));
+        commands.SetSortKey(previousSortKey);
+    }
+
 public:
     ProjectileEmitSystem()
     {
         RequireComponent<ProjectileEmitterComponent>();
         RequireComponent<TransformComponent>();
+        // New projectiles are created through the command buffers, so only the emitters are written
+        WritesComponent<ProjectileEmitterComponent>();
+        ReadsComponent<SpriteComponent>();
+        ReadsResource(RESOURCE_ENTITIES);
+    }
+
+    void CreatePrefabs(const std::unique_ptr<Registry> &registry)
+    {
+        projectilePrefab = registry->CreatePrefab();
+        registry->GroupPrefab(projectilePrefab, projectilesGroup);
+        registry->AddPrefabComponent<SpriteComponent>(projectilePrefab, "bullet-image", 4, 4, 4);
+        registry->AddPrefabComponent<BoxColliderComponent>(projectilePrefab, 4, 4, glm::vec2(0), COLLISION_LAYER_PROJECTILE);
     }
 
     void SubscribeToEvents(std::unique_ptr<EventBus> &eventBus)
     {
-        eventBus->SubscribeToEvent<KeyPressedEvent>(this, &ProjectileEmitSystem::OnKeyPressed);
+        subscriptions.Subscribe<&ProjectileEmitSystem::OnKeyPressed>(*eventBus, this);
     }
 
     void OnKeyPressed(KeyPressedEvent &event)
@@ -33,7 +69,7 @@ public:
         {
             for (auto entity : GetSystemEntities())
             {
-                if (entity.HasTag("player"))
+                if (entity.HasTag(playerTag))
                 {
                     const auto projectileEmitter = entity.GetComponent<ProjectileEmitterComponent>();
                     const auto transform = entity.GetComponent<TransformComponent>();
@@ -64,13 +100,7 @@ public:
                     projectileVelocity.y = projectileEmitter.projectileVelocity.y * directionY;
 
                     // Create new projectile entity and add it to the world
-                    Entity projectile = entity.registry->CreateEntity();
-                    projectile.Group("projectiles");
-                    projectile.AddComponent<TransformComponent>(projectilePosition, glm::vec2(1.0, 1.0), 0.0);
-                    projectile.AddComponent<RigidBodyComponent>(projectileVelocity);
-                    projectile.AddComponent<SpriteComponent>("bullet-image", 4, 4, 4);
-                    projectile.AddComponent<BoxColliderComponent>(4, 4);
-                    projectile.AddComponent<ProjectileComponent>(projectileEmitter.isFriendly, projectileEmitter.hitPercentDamage, projectileEmitter.projectileDuration);
+                    EmitProjectile(entity, projectilePosition, projectileVelocity, projectileEmitter);
                 }
             }
         }
@@ -101,13 +131,7 @@ public:
                 }
 
                 // Add a new projectile entity to the registry
-                Entity projectile = registry->CreateEntity();
-                projectile.Group("projectiles");
-                projectile.AddComponent<TransformComponent>(projectilePosition, glm::vec2(1.0, 1.0), 0.0);
-                projectile.AddComponent<RigidBodyComponent>(projectileEmitter.projectileVelocity);
-                projectile.AddComponent<SpriteComponent>("bullet-image", 4, 4, 4);
-                projectile.AddComponent<BoxColliderComponent>(4, 4);
-                projectile.AddComponent<ProjectileComponent>(projectileEmitter.isFriendly, projectileEmitter.hitPercentDamage, projectileEmitter.projectileDuration);
+                EmitProjectile(entity, projectilePosition, projectileEmitter.projectileVelocity, projectileEmitter);
 
                 // Update the projectile emitter component last emission to the current milliseconds
                 projectileEmitter.lastEmissionTime = SDL_GetTicks();
@@ -10,6 +10,7 @@ public:
     ProjectileLifecycleSystem()
     {
         RequireComponent<ProjectileComponent>();
+        WritesResource(RESOURCE_ENTITIES);
     }
 
     void Update()
@@ -13,9 +13,26 @@
 
 class RenderGUISystem : public System
 {
+private:
+    const GroupId enemiesGroup = Registry::GetGroupId("enemies");
+    PrefabId enemyPrefab = -1;
+
 public:
     RenderGUISystem() = default;
 
+    // Spawned enemies are instances of this prefab, customized with the values of the window
+    void CreatePrefabs(const std::unique_ptr<Registry> &registry)
+    {
+        enemyPrefab = registry->CreatePrefab();
+        registry->GroupPrefab(enemyPrefab, enemiesGroup);
+        registry->AddPrefabComponent<TransformComponent>(enemyPrefab);
+        registry->AddPrefabComponent<RigidBodyComponent>(enemyPrefab);
+        registry->AddPrefabComponent<SpriteComponent>(enemyPrefab, "tank-image", 32, 32, 2);
+        registry->AddPrefabComponent<BoxColliderComponent>(enemyPrefab, 25, 20, glm::vec2(5, 5), COLLISION_LAYER_ENEMY);
+        registry->AddPrefabComponent<ProjectileEmitterComponent>(enemyPrefab);
+        registry->AddPrefabComponent<HealthComponent>(enemyPrefab, 100);
+    }
+
     void Update(const std::unique_ptr<Registry> &registry, const SDL_Rect &camera)
     {
         ImGui::NewFrame();
@@ -86,18 +103,19 @@ public:
             ImGui::Spacing();
 
             // Enemy creation button
-            if (ImGui::Button("Spawn new enemy"))
+            const auto instances = ImGui::Button("Spawn new enemy") ? registry->Instantiate(enemyPrefab) : std::vector<Entity>();
+            if (!instances.empty())
             {
-                Entity enemy = registry->CreateEntity();
-                enemy.Group("enemies");
-                enemy.AddComponent<TransformComponent>(glm::vec2(posX, posY), glm::vec2(scaleX, scaleY), glm::degrees(rotation));
-                enemy.AddComponent<RigidBodyComponent>(glm::vec2(velX, velY));
-                enemy.AddComponent<SpriteComponent>(sprites[selectedSpriteIndex], 32, 32, 2);
-                enemy.AddComponent<BoxColliderComponent>(25, 20, glm::vec2(5, 5));
+                Entity enemy = instances[0];
+                enemy.GetComponent<TransformComponent>() = TransformComponent(glm::vec2(posX, posY), glm::vec2(scaleX, scaleY), glm::degrees(rotation));
+                enemy.GetComponent<RigidBodyComponent>().velocity = glm::vec2(velX, velY);
+                enemy.GetComponent<SpriteComponent>().assetId = sprites[selectedSpriteIndex];
                 double projVelX = cos(projAngle) * projSpeed; // convert from angle-speed to x-value
                 double projVelY = sin(projAngle) * projSpeed; // convert from angle-speed to y-value
-                enemy.AddComponent<ProjectileEmitterComponent>(glm::vec2(projVelX, projVelY), projRepeat * 1000, projDuration * 1000, 10, false);
-                enemy.AddComponent<HealthComponent>(health);
+                enemy.GetComponent<ProjectileEmitterComponent>() = ProjectileEmitterComponent(glm::vec2(projVelX, projVelY), projRepeat * 1000, projDuration * 1000, 10, false);
+                enemy.GetComponent<HealthComponent>().healthPercentage = health;
+                // Writes through GetComponent aren't tracked, the health bar label needs to see the new value
+                enemy.MarkChanged<HealthComponent>();
 
                 // Reset all input values after we create a new enemy
                 posX = posY = rotation = projAngle = 0;
@@ -109,6 +127,55 @@ public:
         }
         ImGui::End();
 
+        // Display the memory and occupancy of the component storages and the size of every system
+        if (ImGui::Begin("Registry stats"))
+        {
+            if (ImGui::CollapsingHeader("Components", ImGuiTreeNodeFlags_DefaultOpen))
+            {
+                ImGui::Columns(7, "components");
+                for (const char *header : {"component", "size", "count", "capacity", "KiB", "grows", "peak"})
+                {
+                    ImGui::Text("%s", header);
+                    ImGui::NextColumn();
+                }
+                ImGui::Separator();
+                for (const auto &stats : registry->GetComponentStats())
+                {
+                    ImGui::Text("%s", stats.name.c_str());
+                    ImGui::NextColumn();
+                    ImGui::Text("%d", static_cast<int>(stats.elementSize));
+                    ImGui::NextColumn();
+                    ImGui::Text("%d", stats.count);
+                    ImGui::NextColumn();
+                    ImGui::Text("%d", stats.capacity);
+                    ImGui::NextColumn();
+                    ImGui::Text("%.1f", stats.bytes / 1024.0);
+                    ImGui::NextColumn();
+                    ImGui::Text("%d", stats.growEvents);
+                    ImGui::NextColumn();
+                    ImGui::Text("%d", stats.peakCount);
+                    ImGui::NextColumn();
+                }
+                ImGui::Columns(1);
+            }
+            ImGui::Spacing();
+
+            if (ImGui::CollapsingHeader("Systems", ImGuiTreeNodeFlags_DefaultOpen))
+            {
+                for (const auto &stats : registry->GetSystemStats())
+                {
+                    ImGui::Text("%s: %d entities", stats.name.c_str(), stats.numEntities);
+                }
+            }
+            ImGui::Spacing();
+
+            if (ImGui::Button("Dump to registry-stats.csv"))
+            {
+                registry->DumpStats("./registry-stats.csv");
+            }
+        }
+        ImGui::End();
+
         // Display a small overlay window to display the map position using the mouse
         ImGuiWindowFlags windowFlags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoNav;
         ImGui::SetNextWindowPos(ImVec2(10, 10), ImGuiCond_Always, ImVec2(0, 0));
@@ -7,9 +7,67 @@
 #include "../Components/SpriteComponent.h"
 #include "../Components/HealthComponent.h"
 #include <SDL2/SDL.h>
+#include <unordered_map>
 
 class RenderHealthBarSystem : public System
 {
+private:
+    // Rendered health percentage text of each entity, only re-rendered when its health changes
+    struct HealthLabel
+    {
+        SDL_Texture *texture = nullptr;
+        int width = 0;
+        int height = 0;
+    };
+    std::unordered_map<EntityHandle, HealthLabel> healthLabels;
+
+    // Change version of the registry when the labels were last updated
+    std::uint32_t lastChangeVersion = 0;
+
+    static SDL_Color GetHealthBarColor(int healthPercentage)
+    {
+        // Draw a the health bar with the correct color for the percentage
+        SDL_Color healthBarColor = {255, 255, 255};
+
+        if (healthPercentage >= 0 && healthPercentage < 40)
+        {
+            // 0-40 = red
+            healthBarColor = {255, 0, 0};
+        }
+        if (healthPercentage >= 40 && healthPercentage < 80)
+        {
+            // 40-80 = yellow
+            healthBarColor = {255, 255, 0};
+        }
+        if (healthPercentage >= 80 && healthPercentage <= 100)
+        {
+            // 80-100 = green
+            healthBarColor = {0, 255, 0};
+        }
+        return healthBarColor;
+    }
+
+    void UpdateHealthLabels(const std::unique_ptr<Registry> &registry, SDL_Renderer *renderer, const std::unique_ptr<AssetStore> &assetStore)
+    {
+        // Re-render the health percentage text of the entities whose health changed since the last update
+        const auto sinceVersion = lastChangeVersion;
+        lastChangeVersion = registry->AdvanceChangeVersion();
+        registry->View<Changed<HealthComponent>>(sinceVersion).Each([&](Entity entity, const HealthComponent &health)
+                                                                    {
+            std::string healthText = std::to_string(health.healthPercentage);
+            SDL_Surface *surface = TTF_RenderText_Blended(assetStore->GetFont("pico8-font-5"), healthText.c_str(), GetHealthBarColor(health.healthPercentage));
+            SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
+            SDL_FreeSurface(surface);
+
+            auto &label = healthLabels[entity.GetHandle()];
+            if (label.texture)
+            {
+                SDL_DestroyTexture(label.texture);
+            }
+            label.texture = texture;
+            SDL_QueryTexture(texture, NULL, NULL, &label.width, &label.height); });
+    }
+
 public:
     RenderHealthBarSystem()
     {
@@ -18,32 +76,40 @@ public:
         RequireComponent<HealthComponent>();
     }
 
-    void Update(SDL_Renderer *renderer, const std::unique_ptr<AssetStore> &assetStore, const SDL_Rect &camera)
+    void ObserveComponents(const std::unique_ptr<Registry> &registry)
     {
-        for (auto entity : GetSystemEntities())
+        registry->OnComponentRemoved<HealthComponent, &RenderHealthBarSystem::OnHealthRemoved>(this);
+    }
+
+    // Forget the label of entities that lose their health (or are killed)
+    void OnHealthRemoved(Entity entity, HealthComponent &health)
+    {
+        auto label = healthLabels.find(entity.GetHandle());
+        if (label != healthLabels.end())
         {
-            const auto transform = entity.GetComponent<TransformComponent>();
-            const auto sprite = entity.GetComponent<SpriteComponent>();
-            const auto health = entity.GetComponent<HealthComponent>();
+            SDL_DestroyTexture(label->second.texture);
+            healthLabels.erase(label);
+        }
+    }
 
-            // Draw a the health bar with the correct color for the percentage
-            SDL_Color healthBarColor = {255, 255, 255};
+    // Release the label textures (before the renderer is destroyed)
+    void ClearHealthLabels()
+    {
+        for (auto &label : healthLabels)
+        {
+            SDL_DestroyTexture(label.second.texture);
+        }
+        healthLabels.clear();
+        lastChangeVersion = 0;
+    }
 
-            if (health.healthPercentage >= 0 && health.healthPercentage < 40)
-            {
-                // 0-40 = red
-                healthBarColor = {255, 0, 0};
-            }
-            if (health.healthPercentage >= 40 && health.healthPercentage < 80)
-            {
-                // 40-80 = yellow
-                healthBarColor = {255, 255, 0};
-            }
-            if (health.healthPercentage >= 80 && health.healthPercentage <= 100)
-            {
-                // 80-100 = green
-                healthBarColor = {0, 255, 0};
-            }
+    void Update(const std::unique_ptr<Registry> &registry, SDL_Renderer *renderer, const std::unique_ptr<AssetStore> &assetStore, const SDL_Rect &camera)
+    {
+        UpdateHealthLabels(registry, renderer, assetStore);
+
+        registry->Each<TransformComponent, SpriteComponent, HealthComponent>([&](Entity entity, const TransformComponent &transform, const SpriteComponent &sprite, const HealthComponent &health)
+                                                                             {
+            SDL_Color healthBarColor = GetHealthBarColor(health.healthPercentage);
 
             // Position the health bar indicator in the top-right part of the entity sprite
             int healthBarWidth = 15;
@@ -59,25 +125,19 @@ public:
             SDL_SetRenderDrawColor(renderer, healthBarColor.r, healthBarColor.g, healthBarColor.b, 255);
             SDL_RenderFillRect(renderer, &healthBarRectangle);
 
-            // Render the health percentage text label indicator
-            std::string healthText = std::to_string(health.healthPercentage);
-            SDL_Surface *surface = TTF_RenderText_Blended(assetStore->GetFont("pico8-font-5"), healthText.c_str(), healthBarColor);
-            SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-            SDL_FreeSurface(surface);
-
-            int labelWidth = 0;
-            int labelHeight = 0;
-            SDL_QueryTexture(texture, NULL, NULL, &labelWidth, &labelHeight);
+            // Render the cached health percentage text label indicator
+            auto label = healthLabels.find(entity.GetHandle());
+            if (label == healthLabels.end())
+            {
+                return;
+            }
             SDL_Rect healthBarTextRectangle = {
                 static_cast<int>(healthBarPosX),
                 static_cast<int>(healthBarPosY) + 5,
-                labelWidth,
-                labelHeight};
+                label->second.width,
+                label->second.height};
 
-            SDL_RenderCopy(renderer, texture, NULL, &healthBarTextRectangle);
-
-            SDL_DestroyTexture(texture);
-        }
+            SDL_RenderCopy(renderer, label->second.texture, NULL, &healthBarTextRectangle); });
     }
 };
 
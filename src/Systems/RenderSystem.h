@@ -5,6 +5,7 @@
 #include "../Components/TransformComponent.h"
 #include "../Components/SpriteComponent.h"
 #include "../AssetStore/AssetStore.h"
+#include "../Memory/FrameArena.h"
 #include <SDL2/SDL.h>
 
 class RenderSystem : public System
@@ -16,45 +17,42 @@ public:
         RequireComponent<SpriteComponent>();
     }
 
-    void Update(SDL_Renderer *renderer, std::unique_ptr<AssetStore> &assetStore, SDL_Rect &camera)
+    void Update(const std::unique_ptr<Registry> &registry, FrameArena &frameArena, SDL_Renderer *renderer, std::unique_ptr<AssetStore> &assetStore, SDL_Rect &camera)
     {
-        // Create a vector with both Sprite and Transform component of all entities
+        // Create a vector pointing to both Sprite and Transform component of all visible entities (allocated in the frame arena)
         struct RenderableEntity
         {
-            TransformComponent transformComponent;
-            SpriteComponent spriteComponent;
+            const TransformComponent *transformComponent;
+            const SpriteComponent *spriteComponent;
         };
-        std::vector<RenderableEntity> renderableEntities;
-        for (auto entity : GetSystemEntities())
-        {
-            RenderableEntity renderableEntity;
-            renderableEntity.spriteComponent = entity.GetComponent<SpriteComponent>();
-            renderableEntity.transformComponent = entity.GetComponent<TransformComponent>();
-
+        auto view = registry->View<TransformComponent, SpriteComponent>();
+        FrameVector<RenderableEntity> renderableEntities(frameArena);
+        renderableEntities.reserve(view.Size());
+        view.Each([&](Entity entity, const TransformComponent &transform, const SpriteComponent &sprite)
+                  {
             // Check if the entity sprite is outside the camera view
-            bool isOutsideCameraView = (renderableEntity.transformComponent.position.x + (renderableEntity.transformComponent.scale.x * renderableEntity.spriteComponent.width) < camera.x ||
-                                        renderableEntity.transformComponent.position.x > camera.x + camera.w ||
-                                        renderableEntity.transformComponent.position.y + (renderableEntity.transformComponent.scale.y * renderableEntity.spriteComponent.height) < camera.y ||
-                                        renderableEntity.transformComponent.position.y > camera.y + camera.h);
+            bool isOutsideCameraView = (transform.position.x + (transform.scale.x * sprite.width) < camera.x ||
+                                        transform.position.x > camera.x + camera.w ||
+                                        transform.position.y + (transform.scale.y * sprite.height) < camera.y ||
+                                        transform.position.y > camera.y + camera.h);
 
             // Cull sprites that are outside the camera view (and are not fixed)
-            if (isOutsideCameraView && !renderableEntity.spriteComponent.isFixed)
+            if (isOutsideCameraView && !sprite.isFixed)
             {
-                continue;
+                return;
             }
 
-            renderableEntities.emplace_back(renderableEntity);
-        }
+            renderableEntities.push_back({&transform, &sprite}); });
 
         // Sort the vector by the z-index value
         std::sort(renderableEntities.begin(), renderableEntities.end(), [](const RenderableEntity &a, const RenderableEntity &b)
-                  { return a.spriteComponent.zIndex < b.spriteComponent.zIndex; });
+                  { return a.spriteComponent->zIndex < b.spriteComponent->zIndex; });
 
         // Loop all entities that the system is interested in
         for (auto entity : renderableEntities)
         {
-            const auto transform = entity.transformComponent;
-            const auto sprite = entity.spriteComponent;
+            const auto &transform = *entity.transformComponent;
+            const auto &sprite = *entity.spriteComponent;
 
             // Set the source rectangle of our original sprite texture
             SDL_Rect srcRect = sprite.srcRect;
@@ -111,6 +111,8 @@ public:
     ScriptSystem()
     {
         RequireComponent<ScriptComponent>();
+        // Scripts can read and change anything through the Lua bindings
+        RequireExclusiveAccess();
     }
 
     void CreateLuaBindings(sol::state &lua)
@@ -119,9 +121,11 @@ public:
         lua.new_usertype<Entity>(
             "entity",
             "get_id", &Entity::GetId,
+            "get_handle", &Entity::GetHandle,
+            "is_valid", &Entity::IsValid,
             "destroy", &Entity::Kill,
-            "has_tag", &Entity::HasTag,
-            "belongs_to_group", &Entity::BelongsToGroup);
+            "has_tag", sol::resolve<bool(const std::string &) const>(&Entity::HasTag),
+            "belongs_to_group", sol::resolve<bool(const std::string &) const>(&Entity::BelongsToGroup));
 
         // Create all the bindings between C++ and Lua functions
         lua.set_function("get_position", GetEntityPosition);
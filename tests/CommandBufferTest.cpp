@@ -0,0 +1,51 @@
+#include "Test.h"
+#include "../src/ECS/ECS.h"
+#include "../src/Components/HealthComponent.h"
+#include <thread>
+
+const int NUM_SOURCES = 4;
+const int NUM_ENTITIES_PER_SOURCE = 50;
+
+// Records the same deferred creations (all with the default sort key) from one thread per source,
+// starting the threads in the given order, and returns the id given to each created entity
+static std::vector<int> FlushFromThreads(const std::vector<int> &sourceOrder)
+{
+    Registry registry;
+    for (auto source : sourceOrder)
+    {
+        std::thread recorder([&registry, source]
+                             {
+                                 auto &commands = registry.GetCommandBuffer();
+                                 commands.SetSource(source);
+                                 for (int i = 0; i < NUM_ENTITIES_PER_SOURCE; i++)
+                                 {
+                                     DeferredEntity entity = commands.CreateEntity();
+                                     commands.AddComponent<HealthComponent>(entity, source * NUM_ENTITIES_PER_SOURCE + i);
+                                 }
+                                 commands.SetSource(0); });
+        recorder.join();
+    }
+    registry.Update();
+
+    // The health value identifies the command that created each entity
+    std::vector<int> ids(NUM_SOURCES * NUM_ENTITIES_PER_SOURCE, -1);
+    registry.View<HealthComponent>().Each([&ids](Entity entity, HealthComponent &health)
+                                          { ids[health.healthPercentage] = entity.GetId(); });
+    return ids;
+}
+
+int main()
+{
+    const auto ids = FlushFromThreads({0, 1, 2, 3});
+    CHECK(std::find(ids.begin(), ids.end(), -1) == ids.end());
+    CHECK(FlushFromThreads({3, 2, 1, 0}) == ids);
+    CHECK(FlushFromThreads({2, 0, 3, 1}) == ids);
+
+    // Entities are created in (sort key, source, recording order) order
+    for (size_t i = 1; i < ids.size(); i++)
+    {
+        CHECK(ids[i] == ids[i - 1] + 1);
+    }
+
+    return TestResult("CommandBufferTest");
+}
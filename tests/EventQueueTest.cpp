@@ -0,0 +1,132 @@
+#include "Test.h"
+#include "../src/EventBus/EventBus.h"
+#include <atomic>
+#include <thread>
+#include <utility>
+
+const int NUM_PRODUCERS = 8;
+const int NUM_EVENTS_PER_PRODUCER = 20000;
+
+class CountedEvent : public Event
+{
+public:
+    int producer;
+    int index;
+    CountedEvent(int producer, int index) : producer(producer), index(index) {}
+};
+
+class Consumer
+{
+public:
+    ScopedSubscriptions subscriptions;
+    std::vector<std::pair<int, int>> received;
+
+    void OnCountedEvents(EventSpan<CountedEvent> events)
+    {
+        for (const auto &event : events)
+        {
+            received.push_back({event.producer, event.index});
+        }
+    }
+};
+
+// Queues the events on a new bus from one thread per producer, all at the same time, and returns the
+// delivered batch. Each thread queues its first event in start order, so the per-thread buffers are
+// created in that order; reversing the start reverses it.
+static std::vector<std::pair<int, int>> HammerQueue(bool deterministicOrder, bool reverseStart = false)
+{
+    EventBus eventBus;
+    eventBus.SetDeterministicOrder(deterministicOrder);
+    Consumer consumer;
+    consumer.subscriptions.Subscribe<&Consumer::OnCountedEvents>(eventBus, &consumer);
+
+    std::atomic<int> nextToStart{0};
+    std::vector<std::thread> producers;
+    for (int position = 0; position < NUM_PRODUCERS; position++)
+    {
+        const int producer = reverseStart ? NUM_PRODUCERS - 1 - position : position;
+        producers.emplace_back([&eventBus, &nextToStart, producer, position]
+                               {
+                                   eventBus.SetProducer(producer);
+                                   for (int i = 0; i < NUM_EVENTS_PER_PRODUCER; i++)
+                                   {
+                                       // Few distinct keys, so most ties are broken by the producer
+                                       eventBus.SetSortKey(i % 3);
+                                       eventBus.QueueEvent<CountedEvent>(producer, i);
+                                       if (i == 0)
+                                       {
+                                           while (nextToStart.load() != position)
+                                           {
+                                               std::this_thread::yield();
+                                           }
+                                           nextToStart++;
+                                       }
+                                   } });
+    }
+    for (auto &producer : producers)
+    {
+        producer.join();
+    }
+    eventBus.DeliverQueuedEvents();
+    auto received = std::move(consumer.received);
+
+    return received;
+}
+
+// Every event arrives exactly once
+static bool IsComplete(const std::vector<std::pair<int, int>> &received)
+{
+    std::vector<bool> seen(NUM_PRODUCERS * NUM_EVENTS_PER_PRODUCER, false);
+    for (const auto &event : received)
+    {
+        const int slot = event.first * NUM_EVENTS_PER_PRODUCER + event.second;
+        if (seen[slot])
+        {
+            return false;
+        }
+        seen[slot] = true;
+    }
+    return received.size() == seen.size();
+}
+
+// Without sorting, the events of each producer keep the order they were queued in
+static bool KeepsProducerOrder(const std::vector<std::pair<int, int>> &received)
+{
+    std::vector<int> lastIndex(NUM_PRODUCERS, -1);
+    for (const auto &event : received)
+    {
+        if (event.second <= lastIndex[event.first])
+        {
+            return false;
+        }
+        lastIndex[event.first] = event.second;
+    }
+    return true;
+}
+
+int main()
+{
+    for (int round = 0; round < 3; round++)
+    {
+        const auto received = HammerQueue(false);
+        CHECK(IsComplete(received));
+        CHECK(KeepsProducerOrder(received));
+    }
+
+    const auto expected = HammerQueue(true);
+    CHECK(IsComplete(expected));
+    for (size_t i = 1; i < expected.size(); i++)
+    {
+        const int key = expected[i].second % 3;
+        const int previousKey = expected[i - 1].second % 3;
+        const bool sameGroup = key == previousKey && expected[i].first == expected[i - 1].first;
+        CHECK(key > previousKey || (key == previousKey && expected[i].first > expected[i - 1].first) ||
+              (sameGroup && expected[i].second > expected[i - 1].second));
+    }
+    for (int round = 0; round < 3; round++)
+    {
+        CHECK(HammerQueue(true, round % 2 == 0) == expected);
+    }
+
+    return TestResult("EventQueueTest");
+}
@@ -0,0 +1,34 @@
+#include "Test.h"
+#include "../src/ECS/ECS.h"
+
+int main()
+{
+    Registry registry;
+    Entity first = registry.CreateEntity();
+    Entity second = registry.CreateEntity();
+    registry.Update();
+
+    // A tag moves to the last entity given it
+    first.Tag("leader");
+    second.Tag("leader");
+    CHECK(!first.HasTag("leader"));
+    CHECK(second.HasTag("leader"));
+    CHECK(registry.GetEntityByTag("leader") == second);
+
+    // Queries never intern the names they are asked about
+    CHECK(!first.HasTag("misspelled-tag"));
+    CHECK(!first.BelongsToGroup("misspelled-group"));
+    CHECK(registry.GetEntitiesByGroup("misspelled-group").empty());
+    CHECK(Registry::FindTagId("misspelled-tag") == -1);
+    CHECK(Registry::FindGroupId("misspelled-group") == -1);
+
+    // Entities that aren't in the registry have no tag or group, and a missing tag gives an invalid entity
+    Entity outOfRange(MAX_ENTITIES + 1);
+    CHECK(!registry.EntityHasTag(outOfRange, Registry::GetTagId("leader")));
+    CHECK(!registry.EntityBelongsToGroup(outOfRange, Registry::GetGroupId("followers")));
+    registry.GroupEntity(outOfRange, Registry::GetGroupId("followers"));
+    registry.RemoveEntityTag(outOfRange);
+    CHECK(!registry.GetEntityByTag("misspelled-tag").IsValid());
+
+    return TestResult("TagGroupTest");
+}
@@ -0,0 +1,28 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <iostream>
+
+////////////////////////////////////////////////////////////////////////////////
+// Minimal test helpers: every test file is a program that runs its checks and
+// returns a non-zero exit code if any of them failed (see "make test")
+////////////////////////////////////////////////////////////////////////////////
+static int numFailedChecks = 0;
+
+#define CHECK(condition)                                                                       \
+    do                                                                                         \
+    {                                                                                          \
+        if (!(condition))                                                                      \
+        {                                                                                      \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            numFailedChecks++;                                                                 \
+        }                                                                                      \
+    } while (false)
+
+inline int TestResult(const char *name)
+{
+    std::cerr << name << (numFailedChecks == 0 ? ": passed" : ": FAILED") << std::endl;
+    return numFailedChecks == 0 ? 0 : 1;
+}
+
+#endif